@@ -0,0 +1,51 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "quirks.h"
+
+class CPU;
+
+// A block of a ROM that was recompiled ahead of time into C++ by ch8rec.
+struct AotBlock {
+    uint16_t start, end;     // bytes of the ROM the block was compiled from, end exclusive
+    uint16_t instructions;   // CHIP-8 instructions executed by one call
+    void (*fn)(CPU& cpu);    // runs the block and its timer ticks, leaving PC at the next instruction
+};
+
+// Everything ch8rec generates for one ROM.
+struct AotProgram {
+    const char* name;
+    QuirkProfile quirks; // the blocks only behave correctly under these
+    const uint8_t* rom;
+    size_t romSize;
+    const AotBlock* blocks;
+    size_t blockCount;
+};
+
+// Defined by the generated translation unit of a recompiled binary, and as NULL by aot_none.cpp otherwise.
+extern const AotProgram* const chip8AotProgram;
+
+// Maps addresses to the recompiled blocks starting there, dropping blocks whose bytes get overwritten.
+class AotRuntime {
+
+private:
+const AotProgram& program;
+const AotBlock* table [4096];
+// true for every RAM byte that some block was compiled from
+bool covered [4096];
+
+public:
+AotRuntime(const AotProgram& program);
+
+// enables the blocks if RAM holds the ROM they were compiled from and the CPU uses the quirks
+// they were compiled for, returns false otherwise
+bool attach(const uint8_t* RAM, QuirkProfile quirks);
+const AotBlock* lookup(uint16_t pc) const { return pc < 4096 ? table[pc] : NULL; }
+// drops every block that was compiled from the given RAM byte
+void invalidate(uint16_t address);
+
+};
+
+#endif
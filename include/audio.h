@@ -0,0 +1,68 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "spsc_queue.h"
+
+// Where the audio thread sends its samples: 16-bit mono at Audio::SAMPLE_RATE.
+class AudioSink {
+public:
+virtual ~AudioSink() {}
+// false if the samples could not be written, which stops the audio thread
+virtual bool write(const int16_t* samples, int count) = 0;
+// true if write() blocks for as long as the samples take to play, like a sound device does,
+// otherwise the audio thread keeps time itself
+virtual bool paced() const { return false; }
+};
+
+// Opens a sink from its name: "alsa" for the default ALSA device (when built with ALSA), "null"
+// to throw the samples away, or "wav:PATH" to record them to a WAV file. Returns NULL with a
+// message on failure.
+AudioSink* openAudioSink(const char* name);
+
+// The CHIP-8 beep. The tone is synthesized once up front and played by a thread of its own, which
+// the emulator only talks to through a lock-free queue of beep on/off events, so a beep never
+// makes the emulation thread wait, fork or allocate.
+class Audio {
+
+public:
+static const int SAMPLE_RATE = 44100;
+
+explicit Audio(AudioSink* sink); // takes ownership of sink
+~Audio();
+Audio(const Audio&) = delete;
+Audio& operator=(const Audio&) = delete;
+
+void start();
+void stop();
+
+// called from the emulation thread, the event is dropped if the audio thread is far behind
+void beep(bool on);
+// With the limit on, a beep starts at most every 100 ms of real time and the
+// ones in between are dropped along with their ends, so a program run far faster than normal
+// neither floods the queue nor turns into a continuous buzz. Safe to call from any thread.
+void setRateLimit(bool on) { rateLimited.store(on, std::memory_order_relaxed); }
+
+private:
+enum Event : uint8_t { BEEP_ON, BEEP_OFF };
+
+// the audio thread: mixes the tone into fixed-size chunks and hands them to the sink
+void run();
+
+AudioSink* sink;
+std::thread thread;
+std::atomic<bool> running;
+SpscQueue<uint8_t, 256> events;
+std::atomic<bool> rateLimited;
+// only used by the thread calling beep()
+bool sounding; // the last event pushed was BEEP_ON
+std::chrono::steady_clock::time_point lastBeep;
+std::vector<int16_t> tone; // exactly one period of the square wave
+
+};
+
+#endif
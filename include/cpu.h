@@ -1,45 +1,183 @@
+#ifndef CPU_H
+#define CPU_H
+
 #include <stdint.h>
 #include <stdio.h>
+#include <iostream>
 #include <cstring>
+#include <type_traits>
+#include "quirks.h"
+#include "rng.h"
 
-class CPU{
+class Jit;
+class AotRuntime;
+class Audio;
 
-private:
+// Handler ids used by the predecode cache, one per distinct CHIP-8 instruction
+enum OpHandler : uint8_t {
+    OP_UNDECODED = 0, // cache entry has not been decoded yet
+    OP_NOP,       // 0NNN and unknown opcodes
+    OP_CLS,       // 00E0
+    OP_RET,       // 00EE
+    OP_JP,        // 1NNN
+    OP_CALL,      // 2NNN
+    OP_SE_NN,     // 3XNN
+    OP_SNE_NN,    // 4XNN
+    OP_SE_VY,     // 5XY0
+    OP_LD_NN,     // 6XNN
+    OP_ADD_NN,    // 7XNN
+    OP_LD_VY,     // 8XY0
+    OP_OR,        // 8XY1
+    OP_AND,       // 8XY2
+    OP_XOR,       // 8XY3
+    OP_ADD_VY,    // 8XY4
+    OP_SUB,       // 8XY5
+    OP_SHR,       // 8XY6
+    OP_SUBN,      // 8XY7
+    OP_SHL,       // 8XYE
+    OP_SNE_VY,    // 9XY0
+    OP_LD_I,      // ANNN
+    OP_JP_V0,     // BNNN
+    OP_RND,       // CXNN
+    OP_DRW,       // DXYN
+    OP_SKP,       // EX9E
+    OP_SKNP,      // EXA1
+    OP_LD_VX_DT,  // FX07
+    OP_LD_VX_K,   // FX0A
+    OP_LD_DT_VX,  // FX15
+    OP_LD_ST_VX,  // FX18
+    OP_ADD_I,     // FX1E
+    OP_LD_F,      // FX29
+    OP_LD_B,      // FX33
+    OP_LD_MEM_VX, // FX55
+    OP_LD_VX_MEM, // FX65
+    // idle loops recognized by decodeAt(), see CPU::skipIdle()
+    OP_JP_SELF,   // 1NNN jumping to itself
+    OP_WAIT_DT,   // FX07 starting an FX07; 3X00; 1NNN loop that polls the delay timer
+    OP_COUNT
+};
+
+// An opcode with its operands already extracted, so it only has to be decoded once
+struct DecodedOp {
+    uint8_t handler; // one of OpHandler
+    uint8_t X, Y, N, NN;
+    uint16_t NNN;
+};
+
+// Everything that makes up the emulated machine and nothing else: no caches, backends, outputs or
+// settings such as the quirk profile. It is trivially copyable, so taking or restoring a snapshot
+// is a single copy of a few kilobytes, see CPU::snapshot() and CPU::restore().
+struct CPUState {
 // Setting up 16 general purpose 8-bit registers, mostly used for memory addresses, so only rightmost 12 bits used. // VF is special in that it's a flag, used by some instuctions
 uint8_t V[16];
 
 // the index register
 uint16_t I;
 
-// timer and delay registers for timings
-uint8_t TIMER,DELAY;
-
 // program counter, used to store current executing stack
 uint16_t PC;
 // stack pointer, used to point to the topmost level of the stack
 uint8_t SP;
 
 // array of 16 16-bit values, used to store the address that the interpreter should return to when finished with a subroutine.
-uint16_t stack [16] = {
-0x00, 0x00, 0x00, 0x00,
-0x00, 0x00, 0x00, 0x00,
-0x00, 0x00, 0x00, 0x00,
-0x00, 0x00, 0x00, 0x00
-};
+uint16_t stack [16];
 
 uint8_t RAM [4096];
 
-// current op code
-uint16_t opcode,X,Y,N,NN,NNN;
+// the 64x32 screen, one word per row with the leftmost pixel in the most significant bit, a set bit means the pixel is on
+uint64_t display [32];
 
-// a 64x32 boolean array of the screen, True means the pixel is on, False means the pixel is off
-bool display [64][32];
+// Emulated time is counted in instructions, so it runs at the same pace on every backend however
+// fast the host is. The delay and sound timers are not ticked, each holds the 60 Hz tick at which
+// it reaches 0 and its value is worked out from the instruction count only when it is read.
+uint64_t cycles; // instructions executed so far
+uint32_t instructionsPerSecond;
+uint64_t tickBase, cycleBase; // the 60 Hz tick at cycle cycleBase, ticks go on from there at the current rate
+uint64_t delayEnd, soundEnd;
+bool beeping; // a beep was started and has not been stopped yet
 
-// stores the current key pressed
-uint8_t pressedKey;
+// the keys held down, bit k for key k, so any number of them can be pressed at once
+uint16_t keypad;
 // variables needed for key press/key release logic to work
-bool waitingForKeyRelease = false;
-uint8_t lastKey = 0xFF;
+bool waitingForKeyRelease;
+uint8_t lastKey;
+
+// random number source for CXNN, seeded with CPU::setSeed()
+Rng rng;
+uint64_t seed;
+};
+static_assert(std::is_trivially_copyable<CPUState>::value, "CPUState must be copyable as plain bytes");
+
+// The machine state lives in the CPUState base, so the instructions use its fields directly
+class CPU : private CPUState {
+
+public:
+// how Run() executes instructions, EXEC_SWITCH is the plain interpreter
+enum ExecMode { EXEC_SWITCH, EXEC_JIT, EXEC_THREADED, EXEC_AOT };
+
+private:
+uint64_t tickAt(uint64_t cycle) const { return tickBase + (cycle - cycleBase) * 60 / instructionsPerSecond; }
+uint64_t currentTick() const { return tickAt(cycles); }
+uint8_t delayTimer() const { uint64_t now = currentTick(); return (delayEnd > now) ? (uint8_t)(delayEnd - now) : 0; }
+uint8_t soundTimer() const { uint64_t now = currentTick(); return (soundEnd > now) ? (uint8_t)(soundEnd - now) : 0; }
+// the beep sounds from the FX18 that sets the sound timer until the end of the Run() in which it runs out
+void startBeep();
+void updateSound();
+
+// rows of display changed since the last takeDirtyRows(), bit y for row y
+uint32_t dirtyRows;
+
+// predecoded instructions for 0x200-0xFFE, indexed by address - 0x200, OP_UNDECODED until first executed
+static const uint16_t DECODE_START = 0x200;
+static const uint16_t DECODE_END = 0xFFF;
+DecodedOp decodeCache [DECODE_END - DECODE_START];
+
+// writes a byte of RAM and drops the predecoded instructions that overlap it
+void writeRAM(uint16_t address, uint8_t value);
+void invalidateDecoded(uint16_t address);
+
+// the interpreter entry points compiled for the current quirk profile, see setQuirks()
+struct Interpreter {
+    void (CPU::*cycle)();
+    void (CPU::*run)(int instructions);
+    void (CPU::*runThreaded)(int instructions);
+    void (CPU::*execute)(const DecodedOp& op);
+};
+template <class Q> static const Interpreter& interpreterFor();
+QuirkProfile quirks;
+const Interpreter* interpreter;
+
+template <class Q> void cycle();
+template <class Q> void runSwitch(int instructions);
+
+// backend used by Run(), plus the native code translator for EXEC_JIT and the block table of a
+// statically recompiled program for EXEC_AOT, each only created when selected
+ExecMode execMode;
+Jit* jit;
+AotRuntime* aot;
+
+// Run() for EXEC_THREADED, a direct-threaded interpreter over the predecode cache
+template <class Q> void runThreaded(int instructions);
+// Run() for EXEC_JIT and EXEC_AOT, native blocks with Cycle() for everything else
+void runJit(int instructions);
+void runAot(int instructions);
+// what native blocks call for an instruction they leave to the interpreter
+static void jitExecute(CPUState* state, DecodedOp op);
+
+// Set by an instruction that left the CPU in an idle loop, OP_UNDECODED otherwise. The run loops
+// then call skipIdle() with what is left of their budget, which spends as much of it as the loop
+// would have and returns how many instructions that was.
+uint8_t idleOp;
+int skipIdle(int instructions);
+bool idleSkipping; // off makes idle loops run instruction by instruction, see setIdleSkipping()
+uint8_t randomByte() { return rng.nextByte(); }
+bool keyHeld(uint8_t key) const { return (keypad >> (key & 0x0F)) & 1; }
+
+// receives the beep on/off events, NULL to keep the sound timer silent
+Audio* audio;
+
+// xxHash64 of the program given to loadROM(), which identifies it in the ROM database and in movies
+uint64_t romHash;
 
 
 public:
@@ -50,25 +188,94 @@ CPU(){ // CPU Constructor, Initializes all fields to their default values
     PC = 0x200;
     SP = 0;
     I = 0;
-    DELAY = 0;
-    TIMER = 0;
-    opcode = 0;
-    pressedKey = 0xFF;
+    cycles = 0;
+    instructionsPerSecond = DEFAULT_INSTRUCTIONS_PER_SECOND;
+    tickBase = 0;
+    cycleBase = 0;
+    delayEnd = 0;
+    soundEnd = 0;
+    beeping = false;
+    keypad = 0;
+    waitingForKeyRelease = false;
+    lastKey = 0xFF;
+    idleOp = OP_UNDECODED;
+    idleSkipping = true;
+    dirtyRows = 0xFFFFFFFF; // nothing has been shown yet
+    audio = NULL;
+    romHash = 0;
+    setSeed(0);
+    execMode = EXEC_SWITCH;
+    jit = NULL;
+    aot = NULL;
+    setQuirks(QUIRKS_DEFAULT);
 
 
     // Clear memory, registers, and display
     memset(RAM, 0, sizeof(RAM));
     memset(V, 0, sizeof(V));
+    memset(stack, 0, sizeof(stack));
     memset(display, 0, sizeof(display));
+    memset(decodeCache, 0, sizeof(decodeCache));
 
 }
 
-~CPU(){};
+~CPU();
+CPU(const CPU&) = delete; // owns the backends, copy the machine state instead
+CPU& operator=(const CPU&) = delete;
+
+// the whole machine state, which restore() can go back to at any later point
+const CPUState& snapshot() const { return *this; }
+// continues from a snapshot, which must not be this CPU's own; code decoded or translated from
+// memory that differs is dropped, the whole screen counts as changed, and the quirk profile,
+// backend and outputs stay as they are
+void restore(const CPUState& state);
 
-bool getPixel(int x, int y) const { return display[x][y]; }
+bool getPixel(int x, int y) const { return (display[y] >> (63 - x)) & 1; }
+// the whole screen at once, 32 rows laid out like display
+const uint64_t* getFrame() const { return display; }
+// returns the rows changed since the last call and starts collecting again
+uint32_t takeDirtyRows() { uint32_t rows = dirtyRows; dirtyRows = 0; return rows; }
 void executeOpcode(uint16_t opcode);
-void Cycle();
-void loadFile(char * filePath);
-void setKeyPress(uint8_t key);
+static DecodedOp decode(uint16_t opcode);
+// decodes the instruction at address in a 4 KB memory image, recognizing the idle loops that start there
+static DecodedOp decodeAt(const uint8_t* memory, uint16_t address);
+// defined in cpu_exec.h, Q is one of the quirk policies in quirks.h
+template <class Q> void executeDecoded(const DecodedOp& op);
+template <class Q> void executeAt(uint16_t address, const DecodedOp& op);
+// advances emulated time by the given number of executed instructions
+void addCycles(int instructions) { cycles += instructions; }
+uint64_t getCycles() const { return cycles; }
+void Cycle() { (this->*interpreter->cycle)(); }
+void Run(int instructions);
+bool setExecMode(ExecMode mode);
+// on by default, off runs idle loops like any other code, for benchmarks that time the backends themselves
+void setIdleSkipping(bool enabled);
+// how many instructions make one second of emulated time, which the timers count down 60 times in
+static const uint32_t DEFAULT_INSTRUCTIONS_PER_SECOND = 480; // 8 per 60 Hz frame
+void setInstructionsPerSecond(uint32_t ips);
+uint32_t getInstructionsPerSecond() const { return instructionsPerSecond; }
+// the instructions in 60 Hz frame number frame, every 60 frames add up to exactly one second
+int instructionsInFrame(uint64_t frame) const {
+    return (int)((frame + 1) * instructionsPerSecond / 60 - frame * instructionsPerSecond / 60);
+}
+// selects how the instructions that differ between interpreters behave
+void setQuirks(QuirkProfile profile);
+QuirkProfile getQuirks() const { return quirks; }
+// true while the program sits in a loop that only a key press or release can end, with no timers
+// running, so the caller can sleep until input arrives
+bool waitingForInput() const;
+bool loadFile(char * filePath);
+bool loadROM(const uint8_t* data, size_t size);
+uint64_t getROMHash() const { return romHash; }
+// the whole keypad at once, bit k set while key k is held down
+void setKeypad(uint16_t keys) { keypad = keys; }
+uint16_t getKeypad() const { return keypad; }
+// where beeps go, NULL (the default) for none; the CPU does not own it
+void setAudio(Audio* output);
+// restarts the CXNN random numbers, the same seed gives the same numbers on every run and backend
+void setSeed(uint64_t s) { seed = s; rng.setSeed(s); }
+uint64_t getSeed() const { return seed; }
+
+};
 
-};
\ No newline at end of file
+#endif
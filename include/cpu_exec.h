@@ -0,0 +1,39 @@
+#ifndef CPU_EXEC_H
+#define CPU_EXEC_H
+
+#include <iostream>
+#include "cpu.h"
+
+// Inline definitions of the instruction dispatch. They live in a header so that code passing a
+// constant DecodedOp, like the blocks generated by the static recompiler, gets the switch folded
+// down to the body of that one instruction.
+
+#if defined(__GNUC__)
+#define CHIP8_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define CHIP8_ALWAYS_INLINE inline
+#endif
+
+template <class Q>
+CHIP8_ALWAYS_INLINE void CPU::executeDecoded(const DecodedOp& op) {
+#define OP(handler) case handler: {
+#define END_OP } break;
+#define END_IDLE_OP END_OP
+    switch (op.handler) {
+#include "cpu_ops.inc"
+    default:
+        break;
+    }
+#undef OP
+#undef END_OP
+#undef END_IDLE_OP
+}
+
+template <class Q>
+CHIP8_ALWAYS_INLINE void CPU::executeAt(uint16_t address, const DecodedOp& op) {
+    PC = address;
+    executeDecoded<Q>(op);
+    PC += 2;
+}
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef EMULATION_H
+#define EMULATION_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include "triple_buffer.h"
+#include "scheduler.h"
+
+class CPU;
+class RewindBuffer;
+class Movie;
+class MoviePlayer;
+
+// A finished CHIP-8 screen, laid out like CPU::getFrame()
+struct Frame {
+    uint64_t rows [32];
+};
+
+// Runs a CPU on a thread of its own, waking 60 times a second and running as many instructions as
+// the CPU's instructions per second call for by then on the monotonic clock, so the display's
+// refresh rate and vsync stalls no longer decide how fast the program runs. The only things
+// shared with the rest of the program are the keypad, an atomic written by the input side, and
+// the frames, published through a triple buffer that the renderer reads whenever it is ready.
+// While the program can only go on once a key changes (CPU::waitingForInput()), the thread sleeps
+// until one does, or until something else is asked of it, instead of waking every frame.
+// Once started, the CPU must not be touched by any other thread until stop() returns.
+class Emulation {
+
+public:
+explicit Emulation(CPU& cpu);
+~Emulation();
+Emulation(const Emulation&) = delete;
+Emulation& operator=(const Emulation&) = delete;
+
+// onFrame is called on the emulation thread after each new frame is published, e.g. to wake
+// a renderer that sleeps until there is something to draw
+void start(void (*onFrame)());
+void stop();
+
+// keypad changes from the input side, picked up at the start of every emulated frame
+void pressKey(uint8_t key) { keypad.fetch_or((uint16_t)(1u << key), std::memory_order_relaxed); wake(); }
+void releaseKey(uint8_t key) { keypad.fetch_and((uint16_t)~(1u << key), std::memory_order_relaxed); wake(); }
+void releaseAllKeys() { keypad.store(0, std::memory_order_relaxed); wake(); }
+
+// Turbo runs the CPU as fast as the host allows, one emulated frame's worth of instructions after
+// another with no waiting. Only every frameSkip-th changed frame is then published, or with 0 only
+// when the renderer has taken the previous one, i.e. about one per host refresh.
+void setTurbo(bool on) { turbo.store(on, std::memory_order_relaxed); }
+bool getTurbo() const { return turbo.load(std::memory_order_relaxed); }
+void setFrameSkip(int n) { frameSkip = n; } // before start()
+
+// Save states are written and read by the emulation thread between two frames, so the input side
+// only asks for one; the file is statePath, set before start()
+void setStatePath(const std::string& path) { statePath = path; }
+void requestSaveState() { stateRequest.store(STATE_SAVE, std::memory_order_relaxed); wake(); }
+void requestLoadState() { stateRequest.store(STATE_LOAD, std::memory_order_relaxed); wake(); }
+
+// With rewind on, the state after every emulated frame is kept for the last frames frames, and
+// while rewinding is set the thread steps back through them one per wake-up instead of running
+// the CPU, so time runs backwards at normal speed. 0 frames (the default) turns it off.
+void setRewindFrames(size_t frames); // before start()
+void setRewinding(bool on) { rewinding.store(on, std::memory_order_relaxed); wake(); }
+
+// Records the keypad changes into movie, which must have been begun on the CPU, until stop()
+// finishes it. Rewinding takes the changes after the frame gone back to out of the movie again, and
+// loading a saved state ends it, since the run no longer follows from power-on.
+void setRecording(Movie* movie) { recording = movie; } // before start()
+
+// Plays a movie instead of taking input from the keypad, the player running on by the instructions
+// due every frame. Seek requests, in frames from where the player is, are served between frames.
+// Rewind and loading saved states are not available while a movie plays.
+void setPlayer(MoviePlayer* moviePlayer) { player = moviePlayer; } // before start()
+void requestSeek(int64_t frames) { seekFrames.fetch_add(frames, std::memory_order_relaxed); }
+
+TripleBuffer<Frame> frames;
+
+// frame pacing and rewind capture statistics of the last run, once it has stopped
+void reportTiming() const;
+
+private:
+enum StateRequest : uint8_t { STATE_NONE, STATE_SAVE, STATE_LOAD };
+
+void run();
+void handleStateRequest();
+void captureFrame();
+// sleeps while the CPU waits for input and nothing the thread should act on has changed
+void waitForInput();
+// called after every change waitForInput() looks at, the lock makes sure the change is not missed
+void wake() { { std::lock_guard<std::mutex> lock(wakeMutex); } wakeup.notify_one(); }
+
+CPU& cpu;
+std::thread thread;
+std::atomic<bool> running;
+std::atomic<uint16_t> keypad; // bit k set while key k is held down
+void (*onFrame)();
+FrameScheduler scheduler;
+std::atomic<bool> turbo;
+int frameSkip;
+std::atomic<uint8_t> stateRequest;
+std::string statePath;
+RewindBuffer* history; // NULL with rewind off
+Movie* recording;      // NULL when not recording
+MoviePlayer* player;   // NULL when not playing a movie
+std::atomic<int64_t> seekFrames;
+std::atomic<bool> rewinding;
+std::mutex wakeMutex;
+std::condition_variable wakeup;
+// nanoseconds spent in RewindBuffer::capture()
+uint64_t captures, captureTime, captureMax;
+
+};
+
+#endif
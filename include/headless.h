@@ -0,0 +1,24 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <stdint.h>
+
+class CPU;
+struct CPUState;
+
+// 64-bit FNV-1a over the 32 rows of a frame as returned by CPU::getFrame(), each row taken most
+// significant byte first, so the same screen hashes the same on every host
+uint64_t hashFrame(const uint64_t* frame);
+
+// 64-bit FNV-1a over everything in a CPUState that the program can observe, field by field and
+// little-endian, so equal machines hash the same on every host whatever their padding holds.
+// Whether a beep is sounding is left out, it depends on where Run() calls ended.
+uint64_t hashState(const CPUState& state);
+
+// Runs frames of a virtual 60 Hz clock back to back at the CPU's instructions per second, with no
+// window, input or sound, then prints
+// the throughput and the hash of the final frame, and with perf the hardware counters of the run.
+// Returns the exit code for main().
+int runHeadless(CPU& cpu, long frames, bool perf);
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "quirks.h"
+
+struct CPUState;
+struct DecodedOp;
+
+// A straight-line run of CHIP-8 instructions translated to x86-64.
+// V0-VF used by the block live in host registers until the block exits.
+struct JitBlock {
+    const uint8_t* code;   // native code of the block, NULL if the instruction at this address has to be interpreted
+    uint16_t start, end;   // bytes of RAM the block was translated from, end exclusive
+    uint16_t instructions; // CHIP-8 instructions in the block, it may stop early when the budget runs out
+    bool translated;       // false until the address has been looked at
+};
+
+class Jit {
+
+public:
+// runs one instruction on the interpreter, for the ones blocks call out to instead of translating
+typedef void (*Helper)(CPUState* state, DecodedOp op);
+
+private:
+// one entry per RAM address, looked up by PC
+JitBlock blocks [4096];
+// true for every RAM byte that some block was translated from
+bool covered [4096];
+
+// executable memory that blocks are emitted into, flushed as a whole once full. It starts with
+// the code that enters the blocks and goes from one to the next, which is kept across flushes.
+uint8_t* code;
+size_t codeSize, codeUsed, runtimeSize;
+typedef int (*Entry)(CPUState* state, int instructions);
+Entry entry;
+// offset in code that blocks jump back to, it looks up the block at the next PC
+size_t dispatch;
+
+Helper helper;
+// quirks the blocks are translated for
+QuirkFlags quirks;
+// idle loops are left to the interpreter while the CPU skips them
+bool idleSkipping;
+
+void emitRuntime();
+void translate(const uint8_t* RAM, uint16_t pc, JitBlock& block);
+
+public:
+explicit Jit(Helper execute);
+~Jit();
+Jit(const Jit&) = delete;
+Jit& operator=(const Jit&) = delete;
+
+// false on non x86-64 hosts or if executable memory could not be mapped
+bool available() const { return entry != NULL; }
+// returns the block starting at pc, translating it on first use
+const JitBlock& lookup(const uint8_t* RAM, uint16_t pc) {
+    JitBlock& block = blocks[pc & 0xFFF];
+    if (!block.translated || block.start != pc) {
+        translate(RAM, pc, block);
+    }
+    return block;
+}
+// Runs translated blocks one after another from state->PC, leaving PC after the last one, and
+// returns how many of the given instructions are left. It stops once they are spent or at a PC
+// whose block has not been translated yet or has to be interpreted, see lookup().
+int run(CPUState* state, int instructions) { return entry(state, instructions); }
+// drops every block that was translated from the given RAM byte
+void invalidate(uint16_t address);
+// drops every block
+void flush();
+// translates future blocks for other quirks, dropping the current ones
+void setQuirks(const QuirkFlags& flags);
+// off translates idle loops like any other code, dropping the current blocks
+void setIdleSkipping(bool enabled);
+
+};
+
+#endif
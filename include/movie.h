@@ -0,0 +1,103 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdint.h>
+#include <vector>
+#include "cpu.h"
+
+// a keypad state and the instruction count from which it holds, see CPU::getCycles()
+struct MovieEvent {
+    uint64_t cycle;
+    uint16_t keypad;
+};
+
+// The input of a run from power-on, which is all it takes to repeat it exactly: the emulation only
+// depends on the ROM, the seed, the quirk profile, the instructions per second and when the
+// keypad changed, counted in executed instructions so it does not matter how the run was split
+// into frames. The file starts with the magic "CH8MOVIE" and a version, then the settings, the
+// length and a hash of the final state, all little-endian, then every keypad change as the
+// instructions since the one before (LEB128) and the new 16-bit keypad.
+class Movie {
+
+public:
+static const uint32_t VERSION = 2; // 2: ROMs are identified by xxHash64 instead of FNV-1a
+
+Movie();
+
+// starts recording a run of cpu, which must have just loaded its ROM
+void begin(const CPU& cpu);
+// notes the keypad the CPU is about to run with from cycle on, only kept if it changed
+void record(uint64_t cycle, uint16_t keypad);
+// forgets the changes after cycle, for when the run went back in time to it
+void truncate(uint64_t cycle);
+// ends the recording where cpu is now
+void finish(const CPU& cpu);
+
+// both return false with a message on failure
+bool save(const char* path) const;
+bool load(const char* path);
+
+uint64_t romHash;
+uint64_t seed;
+QuirkProfile quirks;
+uint32_t instructionsPerSecond;
+uint64_t length;    // instructions in the whole run
+uint64_t finalHash; // hashState() at its end
+std::vector<MovieEvent> events;
+
+};
+
+// Plays a movie on a CPU from any frame on, frames being 60ths of a second of emulated time. Every
+// keyframeInterval frames it keeps a full snapshot of the machine, and buildIndex() plays the whole
+// movie once up front to take them all. Seeking then restores the last keyframe before the target
+// and runs only the frames after it, at full speed with no output, so any point of an hour-long
+// movie is a few milliseconds away. A keyframe takes sizeof(CPUState), about 4.5 KB.
+class MoviePlayer {
+
+public:
+// keyframeInterval 0 keeps no keyframes, seeking back then starts over from power-on
+MoviePlayer(CPU& cpu, const Movie& movie, uint32_t keyframeInterval);
+MoviePlayer(const MoviePlayer&) = delete;
+MoviePlayer& operator=(const MoviePlayer&) = delete;
+
+// configures the CPU, which must have just loaded the movie's ROM, the way the movie was
+// recorded; false with a message if it holds another ROM
+bool start();
+void buildIndex();
+// plays on until the CPU has run cycle instructions, or the movie ends
+void runTo(uint64_t cycle);
+void seek(uint64_t frame);
+
+uint64_t currentFrame() const;
+uint64_t frameCount() const { return frameOf(movie.length); }
+bool finished() const;
+size_t keyframeCount() const { return keyframes.size(); }
+
+private:
+uint64_t cycleOf(uint64_t frame) const { return frame * movie.instructionsPerSecond / 60; }
+// the last frame that starts at or before cycle
+uint64_t frameOf(uint64_t cycle) const { return ((cycle + 1) * 60 + movie.instructionsPerSecond - 1) / movie.instructionsPerSecond - 1; }
+// sets the keypad of every change up to the current instruction
+void applyEvents();
+
+CPU& cpu;
+const Movie& movie;
+uint32_t interval;
+std::vector<CPUState> keyframes; // keyframe k is the state at frame k * interval
+size_t next;                     // the first event not applied yet
+
+};
+
+// Configures cpu, which must already hold the movie's ROM, the way the movie was recorded, then
+// runs it with the keypad changes at their instructions and no window, input or sound, as fast as
+// the host allows. Prints the throughput and whether the final state matched the recording, with
+// perf the hardware counters of the run. Returns the exit code for main(): non-zero for a
+// different ROM or final state.
+int runReplay(CPU& cpu, const Movie& movie, bool perf);
+
+// Indexes the movie with a keyframe every keyframeInterval frames, then seeks from its end to
+// frame and prints how long both took and the hash of the state there. Returns the exit code for
+// main().
+int runSeek(CPU& cpu, const Movie& movie, uint64_t frame, uint32_t keyframeInterval);
+
+#endif
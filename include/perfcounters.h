@@ -0,0 +1,38 @@
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <stdint.h>
+
+// Hardware event counters of the calling thread, read with perf_event_open on Linux. Counters the
+// kernel or the machine does not offer (or that perf_event_paranoid forbids) are simply missing,
+// on other systems all of them are.
+class PerfCounters {
+
+public:
+enum Counter { CYCLES, INSTRUCTIONS, BRANCH_MISSES, L1D_MISSES, COUNTER_COUNT };
+
+private:
+int fds [COUNTER_COUNT]; // -1 for counters that could not be opened
+uint64_t values [COUNTER_COUNT];
+
+public:
+PerfCounters();
+~PerfCounters();
+PerfCounters(const PerfCounters&) = delete;
+PerfCounters& operator=(const PerfCounters&) = delete;
+
+bool available(Counter counter) const { return fds[counter] >= 0; }
+bool anyAvailable() const;
+// zeroes and enables every available counter
+void start();
+// disables them and takes their values, scaled up if the kernel had to multiplex them
+void stop();
+uint64_t value(Counter counter) const { return values[counter]; }
+static const char* name(Counter counter);
+
+// prints every counter from the last start()/stop() per emulated instruction and per frame
+void report(long long instructions, long long frames) const;
+
+};
+
+#endif
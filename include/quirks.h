@@ -0,0 +1,62 @@
+#ifndef QUIRKS_H
+#define QUIRKS_H
+
+// Instructions whose behaviour differs between CHIP-8 interpreters. Each profile is a policy
+// struct of compile-time constants, so every interpreter instantiation only contains the
+// behaviour of its own profile and never tests a quirk while running.
+
+enum QuirkProfile {
+    QUIRKS_DEFAULT, // what this emulator has always done
+    QUIRKS_VIP,     // the original COSMAC VIP interpreter
+    QUIRKS_SCHIP,   // SUPER-CHIP 1.1 on the HP48
+    QUIRKS_XOCHIP,  // Octo's XO-CHIP
+    QUIRKS_COUNT
+};
+
+struct QuirksDefault {
+    static constexpr bool shiftUsesVY = false;       // 8XY6/8XYE shift VY into VX instead of shifting VX
+    static constexpr bool memoryIncrementsI = false; // FX55/FX65 leave I pointing past the last register
+    static constexpr bool jumpUsesVX = false;        // BNNN jumps to XNN + VX instead of NNN + V0
+    static constexpr bool clipSprites = true;        // DXYN clips at the screen edges instead of wrapping
+    static constexpr bool logicResetsVF = false;     // 8XY1/8XY2/8XY3 set VF to 0
+};
+
+struct QuirksVIP {
+    static constexpr bool shiftUsesVY = true;
+    static constexpr bool memoryIncrementsI = true;
+    static constexpr bool jumpUsesVX = false;
+    static constexpr bool clipSprites = true;
+    static constexpr bool logicResetsVF = true;
+};
+
+struct QuirksSCHIP {
+    static constexpr bool shiftUsesVY = false;
+    static constexpr bool memoryIncrementsI = false;
+    static constexpr bool jumpUsesVX = true;
+    static constexpr bool clipSprites = true;
+    static constexpr bool logicResetsVF = false;
+};
+
+struct QuirksXOCHIP {
+    static constexpr bool shiftUsesVY = true;
+    static constexpr bool memoryIncrementsI = true;
+    static constexpr bool jumpUsesVX = false;
+    static constexpr bool clipSprites = false;
+    static constexpr bool logicResetsVF = false;
+};
+
+// The same quirks as plain values, for code that decides once per block rather than per instruction.
+struct QuirkFlags {
+    bool shiftUsesVY;
+    bool memoryIncrementsI;
+    bool jumpUsesVX;
+    bool clipSprites;
+    bool logicResetsVF;
+};
+
+QuirkFlags quirkFlags(QuirkProfile profile);
+// "default", "vip", "schip" or "xochip"
+const char* quirkProfileName(QuirkProfile profile);
+bool parseQuirkProfile(const char* name, QuirkProfile& profile);
+
+#endif
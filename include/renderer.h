@@ -0,0 +1,35 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <stdint.h>
+#include "glad.h"
+
+// Draws the 64x32 CHIP-8 screen with one textured quad. The frame is uploaded as a single-channel
+// texture and a shader maps off/on to the background and pixel colors. Needs a current OpenGL 2.1
+// context for everything, including the destructor.
+class Renderer {
+
+private:
+GLuint texture;
+GLuint program;
+GLuint quad; // vertex buffer with the corners of the full-window quad
+
+// one byte per pixel, 0 for off and 255 for on, in the layout the texture upload wants
+uint8_t pixels [32][64];
+
+public:
+Renderer();
+~Renderer();
+Renderer(const Renderer&) = delete;
+Renderer& operator=(const Renderer&) = delete;
+
+// creates the texture, shader and quad, returns false if the shader does not build
+bool init(const float background[3], const float foreground[3]);
+// copies the given rows of a frame as returned by CPU::getFrame() into the texture, bit y for row y
+void upload(const uint64_t* frame, uint32_t rows);
+// draws the texture over the whole viewport
+void draw();
+
+};
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "cpu.h"
+
+// The last few thousand frames of a run, for stepping back through them. Only the newest state is
+// kept whole. Every frame before it is stored as the XOR of it with the frame after, run-length
+// encoded over 64-bit words. Between two frames little more than the registers, the instruction
+// count and a few rows of the screen usually change, so most entries are a few dozen bytes. All
+// memory is allocated up front: entries go into a fixed ring of bytes, and the oldest ones are
+// dropped when either the frame or the byte limit is reached.
+class RewindBuffer {
+
+public:
+RewindBuffer(size_t maxFrames, size_t maxBytes);
+RewindBuffer(const RewindBuffer&) = delete;
+RewindBuffer& operator=(const RewindBuffer&) = delete;
+
+void clear();
+// adds state as the newest frame, a few hundred nanoseconds for a typical frame
+void capture(const CPUState& state);
+// drops the newest frame, making the one before it current(); false if there is none
+bool stepBack();
+// the newest frame, valid once something was captured
+const CPUState& current() const { return last; }
+bool empty() const { return !captured; }
+
+// how many times stepBack() can succeed, and the bytes their deltas take
+size_t frames() const { return count; }
+size_t bytesUsed() const { return used; }
+
+private:
+// where each delta starts in data and how long it is
+struct Entry {
+    uint32_t offset, size;
+};
+
+static const size_t WORDS = sizeof(CPUState) / 8;
+
+// encodes last ^ state into scratch, returns its length in bytes
+size_t encodeDelta(const CPUState& state);
+void dropOldest();
+
+CPUState last;
+bool captured;
+
+std::vector<uint8_t> data;
+std::vector<Entry> entries; // a ring, oldest at first
+size_t first, count, used;
+std::vector<uint8_t> scratch;
+
+};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+// Random number source for CXNN. Each CPU owns one, so its stream depends only on the seed and on
+// how many numbers it has drawn, never on other instances or threads. xorshift64* keeps the whole
+// generator in one word, which is cheap to draw from and to copy into a snapshot.
+class Rng {
+public:
+    explicit Rng(uint64_t seed = 0) { setSeed(seed); }
+
+    // splitmix64 spreads the seed over the state, so neighbouring seeds give unrelated streams
+    void setSeed(uint64_t seed) {
+        uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        setState(z ^ (z >> 31));
+    }
+
+    uint64_t next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1DULL;
+    }
+
+    // the top byte, the low bits of xorshift64* are its weakest
+    uint8_t nextByte() { return (uint8_t)(next() >> 56); }
+
+    // the position in the stream, restoring it continues exactly where getState() left off
+    uint64_t getState() const { return state; }
+    void setState(uint64_t s) { state = (s != 0) ? s : 0x9E3779B97F4A7C15ULL; } // xorshift never leaves 0
+
+private:
+    uint64_t state;
+};
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef ROMDB_H
+#define ROMDB_H
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include "quirks.h"
+
+// The settings a ROM should run with, each only if the database gives it
+struct RomProfile {
+    std::string name;
+    bool hasQuirks;
+    QuirkProfile quirks;
+    uint32_t instructionsPerSecond; // 0 if not given
+    bool hasKeys;
+    char keys [16];                 // the PC key for CHIP-8 key 0 to F, '0'-'9' or 'a'-'z'
+    bool hasPalette;
+    float background [3], foreground [3];
+};
+
+// Per-ROM settings keyed by the xxHash64 of the ROM (CPU::getROMHash()), so a known program starts
+// with the right ones whatever its file is called. The database is a text file with one ROM per
+// line: the hash as 16 hex digits, then any of
+//   quirks=default|vip|schip|xochip  ips=N  keys=x123qweasdzc4rfv  palette=RRGGBB,RRGGBB  name=...
+// separated by spaces, keys listing the PC keys for CHIP-8 keys 0 to F and palette giving the
+// background, then the pixel color. name takes the rest of the line. '#' starts a comment.
+class RomDatabase {
+
+public:
+// Reads the database at path, replacing what was loaded before. Returns false if the file could
+// not be opened, with a message unless it does not exist; lines that do not parse are reported
+// and skipped.
+bool load(const char* path);
+// NULL for a ROM the database does not know
+const RomProfile* find(uint64_t romHash) const;
+size_t size() const { return profiles.size(); }
+
+private:
+std::unordered_map<uint64_t, RomProfile> profiles;
+
+};
+
+#endif
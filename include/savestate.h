@@ -0,0 +1,19 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include <stdint.h>
+
+struct CPUState;
+
+// Save state files are a 20-byte header followed by a CPUState exactly as it is laid out in memory:
+// the magic "CH8STATE", then the format version, sizeof(CPUState) and 0x01020304, each as a 32-bit
+// value in the host's byte order. A file is only loaded by a build that agrees on all three, since
+// the state is not converted. SAVESTATE_VERSION goes up whenever CPUState changes.
+static const uint32_t SAVESTATE_VERSION = 1;
+
+// both return false with a message if the file could not be written or read, or is not a save
+// state of this version, in which case state is left as it was
+bool saveStateFile(const char* path, const CPUState& state);
+bool loadStateFile(const char* path, CPUState& state);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+
+// nanoseconds on a clock that never jumps, from an arbitrary starting point
+uint64_t monotonicNanoseconds();
+
+// Wakes a thread at a fixed rate against the monotonic clock. Each wait sleeps until shortly
+// before the deadline (clock_nanosleep where available) and spins the rest of the way, since a
+// sleep alone can overshoot by a scheduler tick. Deadlines are absolute, so a late frame does not
+// push the ones after it back. How late every wake-up was, and how far apart they were, is kept
+// for report().
+class FrameScheduler {
+
+public:
+explicit FrameScheduler(uint32_t framesPerSecond);
+
+// the first frame is due right away
+void start();
+// sleeps until the next frame is due, returns the nanoseconds since start()
+uint64_t waitForNextFrame();
+// picks up again after the thread slept on something other than the clock: the next frame is due
+// right away and the pause does not count as a frame interval; returns the nanoseconds since start()
+uint64_t resume();
+// prints the wake-up lateness and frame interval statistics
+void report() const;
+
+private:
+uint64_t period;
+uint64_t startTime, deadline, lastWake;
+
+// lateness and interval statistics, in nanoseconds; the sums are kept for mean and deviation
+uint64_t frames;
+uint64_t lateMax, lateOverMillisecond;
+double lateSum, lateSquares;
+uint64_t intervalMin, intervalMax;
+
+};
+
+#endif
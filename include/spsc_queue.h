@@ -0,0 +1,53 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+
+// Fixed-size ring buffer for one producer thread and one consumer thread, with no locks: each side
+// only writes its own index and reads the other's. Neither push() nor pop() ever blocks, a full
+// queue refuses the item instead. Size must be a power of two, one slot is always left empty.
+template <class T, size_t Size>
+class SpscQueue {
+
+static_assert((Size & (Size - 1)) == 0, "SpscQueue size must be a power of two");
+
+public:
+SpscQueue() : head(0), tail(0) {}
+
+// producer side, false if the queue is full
+bool push(const T& item) {
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t next = (h + 1) & (Size - 1);
+    if (next == tail.load(std::memory_order_acquire)) {
+        return false;
+    }
+    items[h] = item;
+    head.store(next, std::memory_order_release);
+    return true;
+}
+
+// consumer side, false if the queue is empty
+bool pop(T& item) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) {
+        return false;
+    }
+    item = items[t];
+    tail.store((t + 1) & (Size - 1), std::memory_order_release);
+    return true;
+}
+
+private:
+T items [Size];
+// kept a cache line apart, so the two threads do not keep stealing each other's line; padding
+// rather than alignas, which C++11 operator new does not honour
+char padItems [64];
+std::atomic<size_t> head; // next slot to write, only changed by the producer
+char padHead [64 - sizeof(std::atomic<size_t>)];
+std::atomic<size_t> tail; // next slot to read, only changed by the consumer
+char padTail [64 - sizeof(std::atomic<size_t>)];
+
+};
+
+#endif
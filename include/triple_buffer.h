@@ -0,0 +1,45 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+#include <stdint.h>
+
+// Hands the latest value from one writer thread to one reader thread without locks. The writer
+// fills its own buffer and publishes it by swapping it with the middle one; the reader swaps the
+// middle one with its own when something new was published. Neither side ever waits for the
+// other, and values the reader was too slow to pick up are simply overwritten.
+template <class T>
+class TripleBuffer {
+
+public:
+TripleBuffer() : back(0), middle(1), front(2) {}
+
+// writer side: the buffer to fill, then publish() it
+T& writeBuffer() { return buffers[back]; }
+void publish() { back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX; }
+// true once the reader has taken the last published buffer
+bool taken() const { return (middle.load(std::memory_order_acquire) & FRESH) == 0; }
+
+// reader side: moves the most recently published buffer into readBuffer(), false if nothing was
+// published since the last call
+bool update() {
+    if ((middle.load(std::memory_order_relaxed) & FRESH) == 0) {
+        return false;
+    }
+    front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+    return true;
+}
+const T& readBuffer() const { return buffers[front]; }
+
+private:
+static const uint8_t INDEX = 3; // the buffer index held by middle
+static const uint8_t FRESH = 4; // set in middle when it was published and not yet taken
+
+T buffers [3];
+uint8_t back;               // only used by the writer
+std::atomic<uint8_t> middle;
+uint8_t front;              // only used by the reader
+
+};
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef XXHASH64_H
+#define XXHASH64_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// XXH64 by Yann Collet, the same values as the reference implementation, e.g. xxhsum -H64. Fast
+// and well distributed, but not meant to resist deliberately crafted collisions.
+uint64_t xxHash64(const uint8_t* data, size_t size, uint64_t seed = 0);
+
+#endif
@@ -0,0 +1,36 @@
+#include <cstring>
+#include "aot.h"
+
+AotRuntime::AotRuntime(const AotProgram& program) : program(program) {
+    memset(table, 0, sizeof(table));
+    memset(covered, 0, sizeof(covered));
+}
+
+bool AotRuntime::attach(const uint8_t* RAM, QuirkProfile quirks) {
+    memset(table, 0, sizeof(table));
+    memset(covered, 0, sizeof(covered));
+    // blocks are only valid for the exact bytes they were compiled from
+    if (quirks != program.quirks || memcmp(RAM + 0x200, program.rom, program.romSize) != 0) {
+        return false;
+    }
+    for (size_t i = 0; i < program.blockCount; ++i) {
+        const AotBlock& block = program.blocks[i];
+        table[block.start] = &block;
+        for (uint16_t a = block.start; a < block.end; ++a) {
+            covered[a] = true;
+        }
+    }
+    return true;
+}
+
+void AotRuntime::invalidate(uint16_t address) {
+    if (address >= 4096 || !covered[address]) {
+        return;
+    }
+    for (size_t i = 0; i < program.blockCount; ++i) {
+        const AotBlock& block = program.blocks[i];
+        if (block.start <= address && address < block.end) {
+            table[block.start] = NULL;
+        }
+    }
+}
@@ -0,0 +1,4 @@
+#include "aot.h"
+
+// Regular builds carry no recompiled program, see ch8rec and the aot target in the Makefile.
+const AotProgram* const chip8AotProgram = NULL;
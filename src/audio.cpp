@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include "audio.h"
+
+#ifdef CHIP8_HAVE_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+#define AUDIO_TONE_HZ 441          // divides SAMPLE_RATE, so one period is a whole number of samples
+#define AUDIO_AMPLITUDE 6000
+#define AUDIO_CHUNK_SAMPLES 512    // about 12 ms, how far ahead of the speaker the thread mixes
+#define AUDIO_RAMP_SAMPLES 88      // 2 ms fade in and out, so the square wave does not click
+#define AUDIO_MIN_BEEP_INTERVAL std::chrono::milliseconds(100) // with setRateLimit(true)
+
+// discards everything, for machines without a sound device
+class NullSink : public AudioSink {
+public:
+bool write(const int16_t*, int) { return true; }
+};
+
+// 16-bit mono PCM WAV file, the sizes in the header are filled in when it is closed
+class WavSink : public AudioSink {
+public:
+explicit WavSink(FILE* f) : file(f), samples(0) { writeHeader(); }
+~WavSink() {
+    writeHeader();
+    fclose(file);
+}
+bool write(const int16_t* data, int count) {
+    // WAV is little-endian
+    uint8_t bytes [AUDIO_CHUNK_SAMPLES * 2];
+    while (count > 0) {
+        int n = count < AUDIO_CHUNK_SAMPLES ? count : AUDIO_CHUNK_SAMPLES;
+        for (int i = 0; i < n; i++) {
+            bytes[2 * i] = data[i] & 0xFF;
+            bytes[2 * i + 1] = (uint16_t)data[i] >> 8;
+        }
+        if (fwrite(bytes, 2, n, file) != (size_t)n) {
+            return false;
+        }
+        samples += n;
+        data += n;
+        count -= n;
+    }
+    return true;
+}
+
+private:
+static void put32(uint8_t* p, uint32_t v) { p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24; }
+static void put16(uint8_t* p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+void writeHeader() {
+    uint8_t header [44];
+    memcpy(header, "RIFF", 4);
+    put32(header + 4, 36 + samples * 2);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put32(header + 16, 16);              // fmt chunk size
+    put16(header + 20, 1);               // PCM
+    put16(header + 22, 1);               // mono
+    put32(header + 24, Audio::SAMPLE_RATE);
+    put32(header + 28, Audio::SAMPLE_RATE * 2); // bytes per second
+    put16(header + 32, 2);               // bytes per sample frame
+    put16(header + 34, 16);              // bits per sample
+    memcpy(header + 36, "data", 4);
+    put32(header + 40, samples * 2);
+    fseek(file, 0, SEEK_SET);
+    fwrite(header, 1, sizeof(header), file);
+    fseek(file, 0, SEEK_END);
+}
+
+FILE* file;
+uint32_t samples;
+};
+
+#ifdef CHIP8_HAVE_ALSA
+// the default ALSA playback device, whose writes block until there is room in its buffer
+class AlsaSink : public AudioSink {
+public:
+explicit AlsaSink(snd_pcm_t* p) : pcm(p) {}
+~AlsaSink() {
+    snd_pcm_drain(pcm);
+    snd_pcm_close(pcm);
+}
+bool write(const int16_t* data, int count) {
+    while (count > 0) {
+        snd_pcm_sframes_t written = snd_pcm_writei(pcm, data, count);
+        if (written < 0) {
+            // an underrun or a suspend, start the stream again and retry
+            if (snd_pcm_recover(pcm, (int)written, 1) < 0) {
+                std::cerr << "ALSA write failed: " << snd_strerror((int)written) << std::endl;
+                return false;
+            }
+            continue;
+        }
+        data += written;
+        count -= (int)written;
+    }
+    return true;
+}
+bool paced() const { return true; }
+
+private:
+snd_pcm_t* pcm;
+};
+#endif
+
+AudioSink* openAudioSink(const char* name){
+    if (strcmp(name, "null") == 0) {
+        return new NullSink();
+    }
+    if (strncmp(name, "wav:", 4) == 0) {
+        FILE* file = fopen(name + 4, "wb");
+        if (file == NULL) {
+            std::cerr << "Failed to open WAV file: " << name + 4 << std::endl;
+            return NULL;
+        }
+        return new WavSink(file);
+    }
+    if (strcmp(name, "alsa") == 0) {
+#ifdef CHIP8_HAVE_ALSA
+        snd_pcm_t* pcm;
+        int err = snd_pcm_open(&pcm, "default", SND_PCM_STREAM_PLAYBACK, 0);
+        if (err >= 0) {
+            // 50 ms of device buffer, resampling allowed
+            err = snd_pcm_set_params(pcm, SND_PCM_FORMAT_S16, SND_PCM_ACCESS_RW_INTERLEAVED,
+                                     1, Audio::SAMPLE_RATE, 1, 50000);
+            if (err < 0) { snd_pcm_close(pcm); }
+        }
+        if (err < 0) {
+            std::cerr << "Failed to open ALSA device: " << snd_strerror(err) << std::endl;
+            return NULL;
+        }
+        return new AlsaSink(pcm);
+#else
+        std::cerr << "This build has no ALSA support" << std::endl;
+        return NULL;
+#endif
+    }
+    std::cerr << "Unknown audio output: " << name << std::endl;
+    return NULL;
+}
+
+Audio::Audio(AudioSink* s) : sink(s), running(false), rateLimited(false), sounding(false) {
+    // a square wave, the closest thing to what the original hardware's speaker produced
+    int period = SAMPLE_RATE / AUDIO_TONE_HZ;
+    tone.resize(period);
+    for (int i = 0; i < period; i++) {
+        tone[i] = (i < period / 2) ? AUDIO_AMPLITUDE : -AUDIO_AMPLITUDE;
+    }
+}
+
+Audio::~Audio(){
+    stop();
+    delete sink;
+}
+
+void Audio::start(){
+    if (running.load()) {
+        return;
+    }
+    running.store(true);
+    thread = std::thread(&Audio::run, this);
+}
+
+void Audio::stop(){
+    running.store(false);
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void Audio::beep(bool on){
+    if (on) {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (sounding || (rateLimited.load(std::memory_order_relaxed) && now - lastBeep < AUDIO_MIN_BEEP_INTERVAL)) {
+            return;
+        }
+        lastBeep = now;
+    } else if (!sounding) {
+        return; // its start was dropped
+    }
+    if (events.push(on ? BEEP_ON : BEEP_OFF)) {
+        sounding = on;
+    }
+}
+
+void Audio::run(){
+    int16_t chunk [AUDIO_CHUNK_SAMPLES];
+    size_t phase = 0;
+    int gain = 0; // 0 to AUDIO_RAMP_SAMPLES
+    bool on = false;
+    std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+    const std::chrono::nanoseconds chunkTime(1000000000LL * AUDIO_CHUNK_SAMPLES / SAMPLE_RATE);
+
+    while (running.load(std::memory_order_relaxed)) {
+        // the latest state wins, except that a beep switched on and off again since the last chunk
+        // still gets this one, however short it was
+        bool playChunk = on;
+        uint8_t event;
+        while (events.pop(event)) {
+            on = event == BEEP_ON;
+            playChunk |= on;
+        }
+
+        for (int i = 0; i < AUDIO_CHUNK_SAMPLES; i++) {
+            if (playChunk && gain < AUDIO_RAMP_SAMPLES) { gain++; }
+            if (!playChunk && gain > 0) { gain--; }
+            chunk[i] = tone[phase] * gain / AUDIO_RAMP_SAMPLES;
+            phase = (phase + 1 == tone.size()) ? 0 : phase + 1;
+        }
+        if (!sink->write(chunk, AUDIO_CHUNK_SAMPLES)) {
+            break;
+        }
+
+        if (!sink->paced()) {
+            next += chunkTime;
+            std::this_thread::sleep_until(next);
+        }
+    }
+}
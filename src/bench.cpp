@@ -0,0 +1,174 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include "cpu.h"
+#include "headless.h"
+#include "perfcounters.h"
+
+// ch8bench, end-to-end throughput of every backend on a set of ROMs. Each ROM runs headless for a
+// fixed number of instructions in frame-sized Run() calls, like the display loop does, with no key
+// pressed. The best of several runs is reported, each on a freshly created CPU. With --perf the
+// hardware counters of that best run are shown as well. Idle loops are executed like any other
+// code, so every instruction counted was run by the backend, --idle-skip fast-forwards them as the
+// emulator does.
+
+#define BENCH_INSTRUCTIONS_PER_FRAME 8
+
+struct Backend {
+    const char* name;
+    CPU::ExecMode mode;
+};
+
+static const Backend backends[] = {
+    { "switch", CPU::EXEC_SWITCH },
+    { "threaded", CPU::EXEC_THREADED },
+    { "jit", CPU::EXEC_JIT },
+};
+
+struct Result {
+    std::string rom;
+    const char* backend;
+    bool available;
+    double seconds; // best of the repeats
+    uint64_t hash;
+    uint64_t counters [PerfCounters::COUNTER_COUNT]; // of the best run
+};
+
+// runs one ROM, given as the state of a CPU it was loaded into, on one backend, returns false if
+// the backend is not available on this host
+static bool runOnce(const CPUState& loaded, CPU::ExecMode mode, bool idleSkipping, long long instructions,
+                    PerfCounters* counters, double& seconds, uint64_t& hash) {
+    CPU cpu;
+    if (!cpu.setExecMode(mode)) {
+        return false;
+    }
+    cpu.setIdleSkipping(idleSkipping);
+    cpu.restore(loaded);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (counters != NULL) { counters->start(); }
+    long long left = instructions;
+    while (left > 0) {
+        int chunk = left < BENCH_INSTRUCTIONS_PER_FRAME ? (int)left : BENCH_INSTRUCTIONS_PER_FRAME;
+        cpu.Run(chunk);
+        left -= chunk;
+    }
+    if (counters != NULL) { counters->stop(); }
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    hash = hashFrame(cpu.getFrame());
+    return true;
+}
+
+int main(int argc, char** argv) {
+    long long instructions = 10000000;
+    int repeats = 3;
+    bool perf = false;
+    bool idleSkipping = false;
+    std::vector<char*> paths;
+    bool usageError = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--instructions") == 0 && i + 1 < argc) {
+            instructions = atoll(argv[++i]);
+            usageError |= instructions <= 0;
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeats = atoi(argv[++i]);
+            usageError |= repeats <= 0;
+        } else if (strcmp(argv[i], "--perf") == 0) {
+            perf = true;
+        } else if (strcmp(argv[i], "--idle-skip") == 0) {
+            idleSkipping = true;
+        } else if (argv[i][0] != '-') {
+            paths.push_back(argv[i]);
+        } else {
+            usageError = true;
+        }
+    }
+    if (usageError || paths.empty()) {
+        std::cout << "Usage: ./ch8bench [--instructions N] [--repeat R] [--perf] [--idle-skip] ROMfile..." << std::endl;
+        return 1;
+    }
+
+    // opened once, the counters are reset at the start of every run
+    PerfCounters counters;
+    if (perf && !counters.anyAvailable()) {
+        std::cerr << "No hardware performance counters are available" << std::endl;
+    }
+
+    std::vector<Result> results;
+    for (size_t p = 0; p < paths.size(); p++) {
+        CPU rom;
+        if (!rom.loadFile(paths[p])) {
+            return 1;
+        }
+        std::string name = paths[p];
+        size_t slash = name.find_last_of("/\\");
+        if (slash != std::string::npos) {
+            name = name.substr(slash + 1);
+        }
+
+        for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+            Result result;
+            result.rom = name;
+            result.backend = backends[b].name;
+            result.available = true;
+            result.seconds = 0;
+            result.hash = 0;
+            memset(result.counters, 0, sizeof(result.counters));
+            for (int r = 0; r < repeats && result.available; r++) {
+                double seconds = 0;
+                result.available = runOnce(rom.snapshot(), backends[b].mode, idleSkipping, instructions, perf ? &counters : NULL, seconds, result.hash);
+                if (r == 0 || seconds < result.seconds) {
+                    result.seconds = seconds;
+                    for (int c = 0; c < PerfCounters::COUNTER_COUNT; c++) {
+                        result.counters[c] = counters.value((PerfCounters::Counter)c);
+                    }
+                }
+            }
+            results.push_back(result);
+        }
+    }
+
+    // the CPU logs as it is created, so the table comes after all of that
+    printf("\n%lld instructions per run, best of %d, idle loops %s\n", instructions, repeats,
+           idleSkipping ? "skipped" : "executed");
+    printf("%-20s %-10s %14s %12s  %s\n", "ROM", "backend", "instr/s", "ns/instr", "framebuffer hash");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& result = results[i];
+        if (!result.available) {
+            printf("%-20s %-10s %14s %12s  %s\n", result.rom.c_str(), result.backend, "-", "-", "not available on this host");
+            continue;
+        }
+        printf("%-20s %-10s %14.0f %12.3f  %016llx\n", result.rom.c_str(), result.backend,
+               instructions / result.seconds, result.seconds * 1e9 / instructions, (unsigned long long)result.hash);
+    }
+
+    if (perf && counters.anyAvailable()) {
+        // host events per emulated instruction, and per frame of BENCH_INSTRUCTIONS_PER_FRAME instructions
+        printf("\nhardware counters per emulated instruction (per frame)\n");
+        printf("%-20s %-10s", "ROM", "backend");
+        for (int c = 0; c < PerfCounters::COUNTER_COUNT; c++) {
+            printf(" %22s", PerfCounters::name((PerfCounters::Counter)c));
+        }
+        printf("\n");
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result& result = results[i];
+            if (!result.available) {
+                continue;
+            }
+            printf("%-20s %-10s", result.rom.c_str(), result.backend);
+            for (int c = 0; c < PerfCounters::COUNTER_COUNT; c++) {
+                if (!counters.available((PerfCounters::Counter)c)) {
+                    printf(" %22s", "-");
+                    continue;
+                }
+                double perInstruction = (double)result.counters[c] / instructions;
+                printf(" %10.3f (%9.1f)", perInstruction, perInstruction * BENCH_INSTRUCTIONS_PER_FRAME);
+            }
+            printf("\n");
+        }
+    }
+    return 0;
+}
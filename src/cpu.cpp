@@ -1,7 +1,19 @@
 #include <stdint.h>
 #include <iostream>
 #include "cpu.h"
-#include <random>
+#include "cpu_exec.h"
+#include "jit.h"
+#include "aot.h"
+#include "audio.h"
+#include "xxhash64.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CHIP8_MMAP_ROMS 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 // The font used to display numbers on screen, each set of 5 bytes is a single Digit/Number, called by a special drawer function
 uint8_t font [] = {
@@ -23,14 +35,55 @@ uint8_t font [] = {
 0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
-void CPU::loadFile(char * filePath){
+CPU::~CPU(){
+    delete jit;
+    delete aot;
+}
 
-    printf("Loading ROM: %s\n", filePath);
+bool CPU::loadFile(char * filePath){
+#ifdef CHIP8_MMAP_ROMS
+    // the file is mapped and loadROM() copies it into RAM straight from the page cache
+    int fd = open(filePath, O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Failed to Open ROM" << std::endl;
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        std::cerr << "Error reading ROM file" << std::endl;
+        close(fd);
+        return false;
+    }
+    size_t fileSize = (size_t)info.st_size;
 
+    // Check if ROM fits in memory (4096 - 0x200)
+    if (fileSize > 0x1000 - 0x200) {
+        std::cerr << "ROM too large for memory" << std::endl;
+        close(fd);
+        return false;
+    }
+
+    // an empty file cannot be mapped, and there is nothing to map anyway
+    const uint8_t* data = NULL;
+    if (fileSize > 0) {
+        void* mapping = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            std::cerr << "Error reading ROM file" << std::endl;
+            close(fd);
+            return false;
+        }
+        data = (const uint8_t*)mapping;
+    }
+    close(fd); // the mapping stays valid without the descriptor
+
+    bool loaded = loadROM(data, fileSize);
+    if (data != NULL) { munmap((void*)data, fileSize); }
+    return loaded;
+#else
     FILE* rom = fopen(filePath, "rb" );
     if (rom == NULL) {
-        std::cout << "Failed to Open ROM" << std::endl;
-        return;
+        std::cerr << "Failed to Open ROM" << std::endl;
+        return false;
     }
 
     // Get file size
@@ -40,292 +93,367 @@ void CPU::loadFile(char * filePath){
 
     // Check if ROM fits in memory (4096 - 0x200)
     if (fileSize > 0x1000 - 0x200) {
-        std::cout << "ROM too large for memory" << std::endl;
+        std::cerr << "ROM too large for memory" << std::endl;
         fclose(rom);
-        return;
+        return false;
     }
 
-    // Read ROM data into memory starting at 0x200
-    size_t bytesRead = fread(&RAM[0x200], 1, fileSize, rom);
+    // Read ROM data, then copy it into memory starting at 0x200
+    uint8_t data [0x1000 - 0x200];
+    size_t bytesRead = fread(data, 1, fileSize, rom);
     fclose(rom);
     
     if (bytesRead != fileSize) {
-        std::cout << "Error reading ROM file" << std::endl;
-        return;
+        std::cerr << "Error reading ROM file" << std::endl;
+        return false;
     }
-    
-    std::cout << "Loaded " << bytesRead << " bytes into memory" << std::endl;
+
+    return loadROM(data, bytesRead);
+#endif
+}
+
+bool CPU::loadROM(const uint8_t* data, size_t size){
+    // Check if ROM fits in memory (4096 - 0x200)
+    if (size > 0x1000 - 0x200) {
+        std::cerr << "ROM too large for memory" << std::endl;
+        return false;
+    }
+    if (size > 0) { memcpy(&RAM[0x200], data, size); }
+
+    romHash = xxHash64(data, size);
 
     // Load font into memory starting at 0x50
     for (long unsigned int i = 0; i < sizeof(font); ++i) {
         RAM[0x50 + i] = font[i];
     }
+
+    // the program changed, so nothing decoded or translated so far is valid anymore
+    memset(decodeCache, 0, sizeof(decodeCache));
+    if (jit != NULL) { jit->flush(); }
+    if (aot != NULL && !aot->attach(RAM, quirks)) {
+        std::cerr << "ROM does not match the recompiled program, its blocks will not be used" << std::endl;
+    }
+    return true;
 }
 
 
-void CPU::executeOpcode(uint16_t opcode) {
-    uint8_t X = (opcode & 0x0F00) >> 8;
-    uint8_t Y = (opcode & 0x00F0) >> 4;
-    uint8_t N = opcode & 0x000F;
-    uint8_t NN = opcode & 0x00FF;
-    uint16_t NNN = opcode & 0x0FFF;
+DecodedOp CPU::decode(uint16_t opcode) {
+    DecodedOp op;
+    op.X = (opcode & 0x0F00) >> 8;
+    op.Y = (opcode & 0x00F0) >> 4;
+    op.N = opcode & 0x000F;
+    op.NN = opcode & 0x00FF;
+    op.NNN = opcode & 0x0FFF;
+    op.handler = OP_NOP; // 0NNN and unknown opcodes are ignored
 
     switch (opcode & 0xF000) {
     case 0x0000:
-        switch (opcode) {
-        case 0x00E0: // 00E0
-            // Clears the screen
-            memset(display, 0, sizeof(display));
-            break;
-        case 0x00EE: // 00EE
-            // Returns from a subroutine
-            if (SP > 0) {
-                SP--;
-                PC = stack[SP];
-            } else {
-                std::cerr << "Stack underflow at PC=" << std::hex << PC << std::endl;
-            }
-            break;
-        default:
-        // 0NNN should be ignored for most modern emulators
-            break;
-        }
-        break;
-    case 0x1000: // 1NNN
-        // Jumps to address NNN
-        PC = NNN;
-        PC-=2;
-        break;
-    case 0x2000: // 2NNN
-        // Calls subroutine at NNN
-        stack[SP]=PC;
-        SP++;
-        PC = NNN;
-        PC-=2;
-        break;
-    case 0x3000: // 3XNN
-        // Skips the next instruction if VX equals NN
-        if( V[X] == NN){ PC+=2; }
-        break;
-    case 0x4000: // 4XNN
-        // Skips the next instruction if VX does not equal NN
-        if( V[X] != NN){ PC+=2; }
+        if (opcode == 0x00E0) { op.handler = OP_CLS; }
+        else if (opcode == 0x00EE) { op.handler = OP_RET; }
         break;
-    case 0x5000: // 5XY0
-        // Skips the next instruction if VX equals VY
-        if( V[X] == V[Y]){ PC+=2; }
+    case 0x1000: op.handler = OP_JP; break;
+    case 0x2000: op.handler = OP_CALL; break;
+    case 0x3000: op.handler = OP_SE_NN; break;
+    case 0x4000: op.handler = OP_SNE_NN; break;
+    case 0x5000: op.handler = OP_SE_VY; break;
+    case 0x6000: op.handler = OP_LD_NN; break;
+    case 0x7000: op.handler = OP_ADD_NN; break;
+    case 0x8000:
+        switch (op.N) {
+        case 0x0: op.handler = OP_LD_VY; break;
+        case 0x1: op.handler = OP_OR; break;
+        case 0x2: op.handler = OP_AND; break;
+        case 0x3: op.handler = OP_XOR; break;
+        case 0x4: op.handler = OP_ADD_VY; break;
+        case 0x5: op.handler = OP_SUB; break;
+        case 0x6: op.handler = OP_SHR; break;
+        case 0x7: op.handler = OP_SUBN; break;
+        case 0xE: op.handler = OP_SHL; break;
+        }
         break;
-    case 0x6000: // 6XNN
-        // Sets VX to NN
-        V[X] = NN;
+    case 0x9000: op.handler = OP_SNE_VY; break;
+    case 0xA000: op.handler = OP_LD_I; break;
+    case 0xB000: op.handler = OP_JP_V0; break;
+    case 0xC000: op.handler = OP_RND; break;
+    case 0xD000: op.handler = OP_DRW; break;
+    case 0xE000:
+        if (op.NN == 0x9E) { op.handler = OP_SKP; }
+        else if (op.NN == 0xA1) { op.handler = OP_SKNP; }
         break;
-    case 0x7000: // 7XNN
-        // Adds NN to VX
-        V[X] += NN;
+    case 0xF000:
+        switch (op.NN) {
+        case 0x07: op.handler = OP_LD_VX_DT; break;
+        case 0x0A: op.handler = OP_LD_VX_K; break;
+        case 0x15: op.handler = OP_LD_DT_VX; break;
+        case 0x18: op.handler = OP_LD_ST_VX; break;
+        case 0x1E: op.handler = OP_ADD_I; break;
+        case 0x29: op.handler = OP_LD_F; break;
+        case 0x33: op.handler = OP_LD_B; break;
+        case 0x55: op.handler = OP_LD_MEM_VX; break;
+        case 0x65: op.handler = OP_LD_VX_MEM; break;
+        }
         break;
-    case 0x8000:
-        switch (N) {
-        case 0x0000: // 8XY0
-            // Sets VX to the value of VY
-            V[X] = V[Y];
-            break;
-        case 0x0001: // 8XY1
-            // Sets VX to VX or VY
-            V[X] = V[X] | V[Y];
-            break;
-        case 0x0002: // 8XY2
-            // Sets VX to VX and VY
-            V[X] = V[X] & V[Y];
-            break;
-        case 0x0003: // 8XY3
-            // Sets VX to VX xor VY
-            V[X] = V[X] ^ V[Y];
-            break;
-        case 0x0004: // 8XY4
-            // Adds VY to VX
-        {
-            uint16_t sum = V[X] + V[Y];
-            V[0xF] = ( sum > 0xFF ) ? 1 : 0; // Set VF to 1 if there's a carry
-            V[X] = sum & 0xFF;
+    }
+    return op;
+}
+
+DecodedOp CPU::decodeAt(const uint8_t* memory, uint16_t address) {
+    DecodedOp op = decode(memory[address] << 8 | memory[address + 1]);
+    if (op.handler == OP_JP && op.NNN == address) {
+        op.handler = OP_JP_SELF;
+    } else if (op.handler == OP_LD_VX_DT && address + 5 < 0x1000
+               && memory[address + 2] == (0x30 | op.X) && memory[address + 3] == 0x00
+               && (memory[address + 4] << 8 | memory[address + 5]) == (0x1000 | address)) {
+        op.handler = OP_WAIT_DT;
+    }
+    return op;
+}
+
+void CPU::executeOpcode(uint16_t opcode) {
+    (this->*interpreter->execute)(decode(opcode));
+}
+
+void CPU::writeRAM(uint16_t address, uint8_t value) {
+    address &= 0xFFF; // I-relative stores can run past the end of memory, they wrap around like the address bus
+    RAM[address] = value;
+    invalidateDecoded(address);
+    if (jit != NULL) { jit->invalidate(address); }
+    if (aot != NULL) { aot->invalidate(address); }
+}
+
+void CPU::invalidateDecoded(uint16_t address) {
+    // an instruction is 2 bytes, so a store hits the one starting at address and the one starting just before it,
+    // plus a delay timer loop whose 6 bytes it falls in
+    for (int a = address - 5; a <= address; ++a) {
+        if (a >= DECODE_START && a < DECODE_END) {
+            DecodedOp& op = decodeCache[a - DECODE_START];
+            if (a >= address - 1 || op.handler == OP_WAIT_DT) { op.handler = OP_UNDECODED; }
         }
-            break;
-        case 0x0005: // 8XY5
-            // VY is subtracted from VX
-            V[0xF] = (V[X] >= V[Y]) ? 1 : 0; // Set VF to 0 if there's a borrow
-            V[X] -= V[Y];
-            break;
-        case 0x0006: // 8XY6
-            // Shifts VX to the right by 1
-            V[0xF] = V[X] & 0x1; // Save least significant bit in VF
-            V[X] >>= 1;
-            break;
-        case 0x0007: // 8XY7
-            // Sets VX to VY minus VX
-            V[0xF] = (V[Y] >= V[X]) ? 1 : 0; // Set VF to 0 if there's a borrow
-            V[X] = V[Y] - V[X];
-            break;
-        case 0x000E: // 8XYE
-            V[0xF] = (V[X] & 0x80) >> 7; // Save most significant bit in VF
-            // Shifts VX to the left by 1
-            V[X] <<= 1;
-            break;
+    }
+}
+
+int CPU::skipIdle(int instructions){
+    uint8_t handler = idleOp;
+    idleOp = OP_UNDECODED;
+    int skipped = 0;
+    if (!idleSkipping) {
+        return skipped;
+    }
+    if (handler == OP_JP_SELF || handler == OP_LD_VX_K) {
+        // PC is back on the same instruction and only input could change that, which never
+        // arrives in the middle of Run(), so the rest of the budget goes the same way
+        skipped = instructions;
+    } else if (handler == OP_WAIT_DT && instructions >= 2) {
+        // FX07 at PC - 2 read a non-zero delay, so 3X00 and 1NNN bring PC back to it, then every
+        // round of the loop reads the delay again, 3 instructions later, until a round reads 0 and
+        // exits. Only the rounds before that one are skipped.
+        uint8_t X = RAM[PC - 2] & 0x0F;
+        uint64_t firstRead = cycles + 2; // cycle of the next FX07
+        // the first cycle at which the delay timer reads 0
+        uint64_t expires = cycleBase + ((delayEnd - tickBase) * instructionsPerSecond + 59) / 60;
+        uint64_t rounds = (expires > firstRead) ? (expires - firstRead + 2) / 3 : 0;
+        if (rounds > (uint64_t)(instructions - 2) / 3) { rounds = (instructions - 2) / 3; }
+        if (rounds > 0) {
+            uint64_t lastRead = firstRead + 3 * (rounds - 1);
+            V[X] = (uint8_t)(delayEnd - tickAt(lastRead));
         }
+        PC -= 2;
+        skipped = 2 + 3 * (int)rounds;
+    }
+    cycles += skipped;
+    return skipped;
+}
+
+bool CPU::waitingForInput() const {
+    if (delayTimer() != 0 || soundTimer() != 0 || PC >= DECODE_END) {
+        return false;
+    }
+    DecodedOp op = decodeAt(RAM, PC);
+    if (op.handler == OP_JP_SELF) {
+        return true;
+    }
+    // the same conditions under which FX0A stays put
+    return op.handler == OP_LD_VX_K && (waitingForKeyRelease ? keyHeld(lastKey) : keypad == 0);
+}
+
+template <class Q>
+void CPU::cycle(){
+    if (PC >= DECODE_START && PC < DECODE_END) {
+        // program memory goes through the predecode cache, fetching and decoding only on the first visit to an address
+        DecodedOp& op = decodeCache[PC - DECODE_START];
+        if (op.handler == OP_UNDECODED) { op = decodeAt(RAM, PC); }
+        executeDecoded<Q>(op);
+    } else {
+        // The Current Opcode is the OR of the 2 consecutive bytes in memory, which wrap around at its end like I does
+        uint16_t opcode = RAM[PC & 0xFFF] << 8 | RAM[(PC + 1) & 0xFFF];
+        executeDecoded<Q>(decode(opcode)); // jump to opcode execution switch case to decode and execute opcode
+    }
+    cycles++;
+    PC+=2; // No matter the opcode, incremnt PC by 2, logic for halting and looping implemented inside opcodes
+}
+
+void CPU::startBeep(){
+    beeping = true;
+    if (audio != NULL) { audio->beep(true); }
+}
+
+void CPU::updateSound(){
+    if (beeping && currentTick() >= soundEnd) {
+        beeping = false;
+        if (audio != NULL) { audio->beep(false); }
+    }
+}
+
+void CPU::setAudio(Audio* output){
+    if (beeping && audio != NULL) { audio->beep(false); } // not left sounding on the old output
+    audio = output;
+    if (beeping && audio != NULL) { audio->beep(true); }
+}
+
+void CPU::restore(const CPUState& state){
+    bool wasBeeping = beeping;
+    // memory goes back through writeRAM() only where it differs, so what was decoded or translated
+    // from the bytes that did not change stays usable, which keeps stepping between snapshots cheap
+    for (uint16_t address = 0; address < sizeof(RAM); ++address) {
+        if (RAM[address] != state.RAM[address]) { writeRAM(address, state.RAM[address]); }
+    }
+    static_cast<CPUState&>(*this) = state;
+    idleOp = OP_UNDECODED;
+    dirtyRows = 0xFFFFFFFF;
+    if (beeping != wasBeeping && audio != NULL) { audio->beep(beeping); }
+}
+
+void CPU::setInstructionsPerSecond(uint32_t ips){
+    if (ips == 0) { ips = 1; }
+    // the ticks so far stay as they were, only the ones from now on come at the new rate
+    tickBase = currentTick();
+    cycleBase = cycles;
+    instructionsPerSecond = ips;
+}
+
+void CPU::Run(int instructions){
+    idleOp = OP_UNDECODED; // whatever a lone Cycle() left behind
+    switch (execMode) {
+    case EXEC_THREADED:
+        (this->*interpreter->runThreaded)(instructions);
         break;
-    case 0x9000: // 9XY0
-        // Skips the next instruction if VX does not equal VY
-        if( V[X] != V[Y]){ PC+=2; }
+    case EXEC_JIT:
+        runJit(instructions);
         break;
-    case 0xA000: // ANNN
-        // Sets I to the address NNN
-        I = NNN;
+    case EXEC_AOT:
+        runAot(instructions);
         break;
-    case 0xB000: // BNNN
-        // Jumps to the address NNN plus V0
-        PC = NNN + V[0];
-        PC-=2;
+    default:
+        (this->*interpreter->run)(instructions);
         break;
-    case 0xC000: // CXNN
-    {    // Sets VX to the result of a bitwise and operation on a random number and NN
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-        static std::uniform_int_distribution<> dis(0, 255);
-        V[X] = dis(gen) & NN;
     }
+    updateSound();
+}
+
+template <class Q>
+void CPU::runSwitch(int instructions){
+    while (instructions > 0) {
+        cycle<Q>();
+        instructions--;
+        if (idleOp != OP_UNDECODED) { instructions -= skipIdle(instructions); }
+    }
+}
+
+// Every quirk profile gets its own copy of the interpreters with the quirks folded in at compile
+// time, setQuirks() only swaps which copy the member function pointers lead to.
+
+template <class Q>
+const CPU::Interpreter& CPU::interpreterFor(){
+    static const Interpreter interpreter = {
+        &CPU::cycle<Q>, &CPU::runSwitch<Q>, &CPU::runThreaded<Q>, &CPU::executeDecoded<Q>
+    };
+    return interpreter;
+}
+
+void CPU::setQuirks(QuirkProfile profile){
+    switch (profile) {
+    case QUIRKS_VIP: interpreter = &interpreterFor<QuirksVIP>(); break;
+    case QUIRKS_SCHIP: interpreter = &interpreterFor<QuirksSCHIP>(); break;
+    case QUIRKS_XOCHIP: interpreter = &interpreterFor<QuirksXOCHIP>(); break;
+    default:
+        profile = QUIRKS_DEFAULT;
+        interpreter = &interpreterFor<QuirksDefault>();
         break;
-    case 0xD000: // DXYN
-        // Draws a sprite at coordinate (VX, VY) with width of 8 pixels and height of N pixels
-        // We use modulo for screen wrapping at edges to happen nicely
-        // x is the x coordinate, y is the y coordinate, h is the height (amount of lines), p is the current pixel.
-        {
-        uint8_t xCoord = V[X] % 64;
-        uint8_t yCoord = V[Y] % 32;
-        V[0xF]=0; // VF = 0
-
-        for (int row = 0; row < N; row++) {
-            if (yCoord >= 32) break;  // stop if we go past screen height
-
-             // read the row of sprite data from memory
-            uint8_t spriteByte = RAM[I + row];
-
-            // draw each bit of this row
-            for (int bit = 0; bit < 8; bit++) {
-                if (xCoord >= 64) break;   // stop if we go past screen width
-
-                // check if the current bit is set
-                if (spriteByte & (0x80 >> bit)) {
-                    // if screen pixel is on, turn it off and set VF=1
-                    if (display[xCoord][yCoord]) {
-                        display[xCoord][yCoord] = false;
-                        V[0xF] = 1;
-                    } else {
-                        // otherwise, turn it on
-                        display[xCoord][yCoord] = true;
-                    }
-                }
-                ++xCoord;
-            }
-
-            // reset x for the next row, then increment y
-            xCoord = V[X] % 64;
-            ++yCoord;
-            }
-        }
-        break;
-    case 0xE000:
-        switch (opcode & 0x00FF) {
-        case 0x009E: // EX9E
-            // Skips the next instruction if the key stored in VX is pressed
-            if (V[X] == pressedKey){ PC+=2; }
-            break;
-        case 0x00A1: // EXA1
-            // Skips the next instruction if the key stored in VX is not pressed
-            if (V[X] != pressedKey){ PC+=2; }
-            break;
+    }
+    quirks = profile;
+    // native code was generated for the old quirks
+    if (jit != NULL) { jit->setQuirks(quirkFlags(quirks)); }
+    if (aot != NULL && !aot->attach(RAM, quirks)) {
+        std::cerr << "Recompiled program was built for other quirks, its blocks will not be used" << std::endl;
+    }
+}
+
+// A block of the static recompiler only runs if it fits in what is left and JIT blocks stop by
+// themselves once it is spent, so timers and input see the same instruction counts as with
+// Cycle(). While idle loops are skipped the JIT leaves them to Cycle(), which can skip them.
+
+void CPU::runJit(int instructions){
+    while (instructions > 0) {
+        if (jit->lookup(RAM, PC).code != NULL) {
+            // goes on from block to block until one that is not translated yet, counting its own cycles
+            instructions = jit->run(this, instructions);
+        } else {
+            Cycle();
+            instructions--;
+            if (idleOp != OP_UNDECODED) { instructions -= skipIdle(instructions); }
         }
-        break;
-    case 0xF000:
-        switch (opcode & 0x00FF) {
-        case 0x0007: // FX07
-            // Sets VX to the value of the delay timer
-            V[X] = DELAY;
-            break;
-        case 0x000A: // FX0A
-            // A key press is awaited, and then stored in VX            
-            if (waitingForKeyRelease) {
-                // We've captured a key press and are waiting for release
-                if (pressedKey == 0xFF) {
-                    // Key has been released, continue execution
-                    waitingForKeyRelease = false;
-                } else {
-                    // Key still pressed, wait
-                    PC -= 2;
-                }
-            } else {
-                // Waiting for initial key press
-                if (pressedKey != 0xFF) {
-                    // Key pressed, save it
-                    V[X] = pressedKey;
-                    lastKey = pressedKey;
-                    waitingForKeyRelease = true;
-                    PC -= 2;  // Stay on this instruction
-                } else {
-                    // No key pressed, keep waiting
-                    PC -= 2;
-                }
-            }
-            break; 
-        case 0x0015: // FX15
-            // Sets the delay timer to VX
-            DELAY = V[X];
-            break;
-        case 0x0018: // FX18
-            // Sets the sound timer to VX
-            TIMER = V[X];
-            break;
-        case 0x001E: // FX1E
-            // Adds VX to I
-            I += V[X];
-            break;
-        case 0x0029: // FX29
-            // Sets I to the location of the sprite for the character in VX
-            I = 0x50 + (V[X] * 5);
-            break;
-        case 0x0033: // FX33
-            // Stores the binary-coded decimal representation of VX
-            RAM[I] = V[X] / 100;
-            RAM[I + 1] = (V[X] / 10) % 10;
-            RAM[I + 2] = V[X] % 10;
-            break;
-        case 0x0055: // FX55
-            // Stores from V0 to VX in memory starting at address I
-            for (int i = 0; i <= X; ++i) {
-                RAM[I + i] = V[i];
-            }
-            break;
-        case 0x0065: // FX65
-            // Fills from V0 to VX with values from memory starting at address I
-            for (int i = 0; i <= X; ++i) {
-                V[i] = RAM[I + i];
-            }
-            break;
+    }
+}
+
+void CPU::jitExecute(CPUState* state, DecodedOp op){
+    CPU* cpu = static_cast<CPU*>(state);
+    (cpu->*cpu->interpreter->execute)(op);
+}
+
+void CPU::runAot(int instructions){
+    while (instructions > 0) {
+        const AotBlock* block = aot->lookup(PC);
+        if (block != NULL && block->instructions <= instructions) {
+            block->fn(*this); // counts its own instructions
+            instructions -= block->instructions;
+        } else {
+            Cycle();
+            instructions--;
         }
-        break;
-    default:
-        // Unknown opcode
-        break;
+        if (idleOp != OP_UNDECODED) { instructions -= skipIdle(instructions); }
     }
 }
 
-void CPU::Cycle(){
-    opcode = RAM[PC] << 8 | RAM[PC + 1]; // The Current Opcode is the OR of the 2 consecutive bytes in memory
-    executeOpcode(opcode); // jump to opcode execution switch case to decode and execute opcode
-    if(DELAY > 0){ DELAY--; } // decrement delay timer
-    if (TIMER == 1) { system("mpg123 meow.mp3 > /dev/null 2>&1 &");} // play the defined "beep" sound, running concurrently with program
-    // dev/null output redirection to prevent console from being spammed whenever the sound is decoded
-    if (TIMER > 0){ TIMER--; } // decrement timer
-    PC+=2; // No matter the opcode, incremnt PC by 2, logic for halting and looping implemented inside opcodes
+void CPU::setIdleSkipping(bool enabled){
+    idleSkipping = enabled;
+    if (jit != NULL) { jit->setIdleSkipping(enabled); }
 }
 
-void CPU::setKeyPress(uint8_t key) {
-    pressedKey = key;
+bool CPU::setExecMode(ExecMode mode){
+    delete jit;
+    jit = NULL;
+    delete aot;
+    aot = NULL;
+    execMode = mode;
+    if (mode == EXEC_JIT) {
+        jit = new Jit(&CPU::jitExecute);
+        jit->setQuirks(quirkFlags(quirks));
+        jit->setIdleSkipping(idleSkipping);
+        if (!jit->available()) {
+            std::cerr << "JIT backend is not available on this host, using the interpreter" << std::endl;
+            delete jit;
+            jit = NULL;
+            execMode = EXEC_SWITCH;
+            return false;
+        }
+    } else if (mode == EXEC_AOT) {
+        if (chip8AotProgram == NULL) {
+            std::cerr << "No recompiled program is linked into this binary, using the interpreter" << std::endl;
+            execMode = EXEC_SWITCH;
+            return false;
+        }
+        aot = new AotRuntime(*chip8AotProgram);
+        aot->attach(RAM, quirks);
+    }
+    return true;
 }
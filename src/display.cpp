@@ -1,68 +1,242 @@
 #include "glad.h"
 #include <GLFW/glfw3.h>
 #include <iostream>
+#include <cstdlib>
+#include <cctype>
+#include <random>
 #include "cpu.h"
+#include "aot.h"
+#include "renderer.h"
+#include "headless.h"
+#include "audio.h"
+#include "emulation.h"
+#include "movie.h"
+#include "romdb.h"
 
-#define CHIP8_INSTRUCTIONS_PER_FRAME 8
+#ifdef CHIP8_HAVE_ALSA
+#define CHIP8_DEFAULT_AUDIO "alsa"
+#else
+#define CHIP8_DEFAULT_AUDIO "null"
+#endif
+
+#define CHIP8_DEFAULT_ROMDB "romdb.txt"
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
-void processInput(GLFWwindow *window, CPU& cpu);
+void window_refresh_callback(GLFWwindow* window);
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
+void window_focus_callback(GLFWwindow* window, int focused);
+
+// set when the window contents were lost or resized, so the next frame is drawn even if the CHIP-8 screen did not change
+bool windowDamaged = true;
 
-char keyPress;
+// the beep output, NULL without a sound device; rate limited while in turbo
+Audio* audio = NULL;
 
 // Game Boy-inspired color scheme
-const float BG_COLOR_R = 0.06f;    // #0f380f - dark green background
-const float BG_COLOR_G = 0.22f;
-const float BG_COLOR_B = 0.06f;
+const float BG_COLOR[3] = { 0.06f, 0.22f, 0.06f };    // #0f380f - dark green background
+const float PIXEL_COLOR[3] = { 0.61f, 0.74f, 0.06f }; // #9bbc0f - light green pixels
 
-const float PIXEL_COLOR_R = 0.61f; // #9bbc0f - light green pixels
-const float PIXEL_COLOR_G = 0.74f;
-const float PIXEL_COLOR_B = 0.06f;
+// CHIP-8 keypad layout:
+// 1 2 3 C    maps to    1 2 3 4
+// 4 5 6 D                Q W E R
+// 7 8 9 E                A S D F
+// A 0 B F                Z X C V
+const int KEYMAP[16] = {
+    GLFW_KEY_X, GLFW_KEY_1, GLFW_KEY_2, GLFW_KEY_3, // 0 1 2 3
+    GLFW_KEY_Q, GLFW_KEY_W, GLFW_KEY_E, GLFW_KEY_A, // 4 5 6 7
+    GLFW_KEY_S, GLFW_KEY_D, GLFW_KEY_Z, GLFW_KEY_C, // 8 9 A B
+    GLFW_KEY_4, GLFW_KEY_R, GLFW_KEY_F, GLFW_KEY_V  // C D E F
+};
+
+// the PC key for each CHIP-8 key, KEYMAP unless the ROM database has a key map for the program
+int keymap[16];
 
 // settings
 const unsigned int SCR_WIDTH = 640;
 const unsigned int SCR_HEIGHT = 320;
 
-void renderChip8Display(const CPU& cpu) {
-    // Set up 2D orthographic projection
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    glOrtho(0, SCR_WIDTH, SCR_HEIGHT, 0, -1, 1);
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
-
-    const float pixelWidth = (float)SCR_WIDTH / 64;
-    const float pixelHeight = (float)SCR_HEIGHT / 32;
-    
-    glBegin(GL_QUADS);
-    for (int y = 0; y < 32; y++) {
-        for (int x = 0; x < 64; x++) {
-            if (cpu.getPixel(x, y)) {
-                // If pixel is on, draw a white square
-                float x1 = x * pixelWidth;
-                float y1 = y * pixelHeight;
-                float x2 = (x + 1) * pixelWidth;
-                float y2 = (y + 1) * pixelHeight;
-                
-                glColor3f(PIXEL_COLOR_R, PIXEL_COLOR_G, PIXEL_COLOR_B); // White color
-                glVertex2f(x1, y1);
-                glVertex2f(x2, y1);
-                glVertex2f(x2, y2);
-                glVertex2f(x1, y2);
-            }
+int main(int argc, char **argv)
+{
+
+    // a binary built by "make aot" carries its own ROM and runs the recompiled blocks by default
+    char* romPath = NULL;
+    bool usageError = false;
+    bool headless = false;
+    bool perf = false;
+    bool timingStats = false;
+    bool turbo = false;
+    long frameSkip = 0;
+    long rewindSeconds = 60;
+    long headlessFrames = 600;
+    long ips = CPU::DEFAULT_INSTRUCTIONS_PER_SECOND;
+    const char* audioOutput = CHIP8_DEFAULT_AUDIO;
+    const char* recordPath = NULL;
+    const char* replayPath = NULL;
+    const char* playPath = NULL;
+    const char* romdbPath = CHIP8_DEFAULT_ROMDB;
+    bool quirksGiven = false;
+    bool ipsGiven = false;
+    long seekFrame = -1;
+    long keyframeInterval = 300;
+    bool seeded = false;
+    unsigned long long seed = 0;
+    CPU::ExecMode execMode = (chip8AotProgram != NULL) ? CPU::EXEC_AOT : CPU::EXEC_SWITCH;
+    QuirkProfile quirks = (chip8AotProgram != NULL) ? chip8AotProgram->quirks : QUIRKS_DEFAULT;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--interp=switch") == 0) {
+            execMode = CPU::EXEC_SWITCH;
+        } else if (strcmp(argv[i], "--interp=jit") == 0) {
+            execMode = CPU::EXEC_JIT;
+        } else if (strcmp(argv[i], "--interp=threaded") == 0) {
+            execMode = CPU::EXEC_THREADED;
+        } else if (strcmp(argv[i], "--interp=aot") == 0) {
+            execMode = CPU::EXEC_AOT;
+        } else if (strncmp(argv[i], "--quirks=", 9) == 0) {
+            usageError |= !parseQuirkProfile(argv[i] + 9, quirks);
+            quirksGiven = true;
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        } else if (strcmp(argv[i], "--turbo") == 0) {
+            turbo = true;
+        } else if (strncmp(argv[i], "--frameskip=", 12) == 0) {
+            char* end;
+            frameSkip = strtol(argv[i] + 12, &end, 10);
+            usageError |= *end != '\0' || frameSkip < 0;
+        } else if (strncmp(argv[i], "--rewind=", 9) == 0) {
+            char* end;
+            rewindSeconds = strtol(argv[i] + 9, &end, 10);
+            usageError |= *end != '\0' || rewindSeconds < 0;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            timingStats = true;
+        } else if (strcmp(argv[i], "--perf") == 0) {
+            perf = true;
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            char* end;
+            seed = strtoull(argv[i] + 7, &end, 0);
+            usageError |= *end != '\0' || argv[i][7] == '\0';
+            seeded = true;
+        } else if (strncmp(argv[i], "--ips=", 6) == 0) {
+            char* end;
+            ips = strtol(argv[i] + 6, &end, 10);
+            usageError |= *end != '\0' || ips <= 0;
+            ipsGiven = true;
+        } else if (strncmp(argv[i], "--audio=", 8) == 0) {
+            audioOutput = argv[i] + 8;
+        } else if (strncmp(argv[i], "--romdb=", 8) == 0) {
+            romdbPath = argv[i] + 8;
+        } else if (strncmp(argv[i], "--record=", 9) == 0) {
+            recordPath = argv[i] + 9;
+        } else if (strncmp(argv[i], "--replay=", 9) == 0) {
+            replayPath = argv[i] + 9;
+        } else if (strncmp(argv[i], "--play=", 7) == 0) {
+            playPath = argv[i] + 7;
+        } else if (strncmp(argv[i], "--seek=", 7) == 0) {
+            char* end;
+            seekFrame = strtol(argv[i] + 7, &end, 10);
+            usageError |= *end != '\0' || seekFrame < 0;
+        } else if (strncmp(argv[i], "--keyframes=", 12) == 0) {
+            char* end;
+            keyframeInterval = strtol(argv[i] + 12, &end, 10);
+            usageError |= *end != '\0' || keyframeInterval <= 0;
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            char* end;
+            headlessFrames = strtol(argv[++i], &end, 10);
+            usageError |= *end != '\0' || headlessFrames < 0;
+        } else if (argv[i][0] != '-' && romPath == NULL) {
+            romPath = argv[i];
+        } else {
+            usageError = true;
         }
     }
-    glEnd();
-}
 
+    usageError |= recordPath != NULL && playPath != NULL;
+    // recording and playing a movie need the window, the windowless modes would silently leave them out
+    usageError |= (recordPath != NULL || playPath != NULL) && (headless || replayPath != NULL);
+    if (usageError || (romPath == NULL && chip8AotProgram == NULL)) {
+        std::cout << "Usage: ./CHIP-8_Emulator [--interp=switch|jit|threaded|aot] [--quirks=default|vip|schip|xochip] [--seed=N] [--ips=N] [--audio=alsa|null|wav:FILE] [--romdb=FILE] [--stats] [--turbo] [--frameskip=N] [--rewind=SECONDS] [--record=FILE | --play=FILE [--keyframes=N] | --headless [--frames N] [--perf] | --replay=FILE [--perf | --seek=FRAME [--keyframes=N]]] ROMfile" << std::endl;
+        return 1;
+    }
 
-int main(int argc, char **argv)
-{
+    // a game gets different random numbers every time it is played, unless asked to repeat a run;
+    // headless runs are for comparing results, so they keep the fixed default seed
+    if (!seeded && !headless) {
+        std::random_device rd;
+        seed = (unsigned long long)rd() << 32 | rd();
+    }
+
+    CPU cpu;
+    cpu.setSeed(seed);
+    cpu.setInstructionsPerSecond(ips);
+    cpu.setQuirks(quirks);
+    cpu.setExecMode(execMode);
+    if (romPath != NULL) {
+        if (!cpu.loadFile(romPath) && (headless || replayPath != NULL || playPath != NULL)) {
+            return 1;
+        }
+    } else {
+        cpu.loadROM(chip8AotProgram->rom, chip8AotProgram->romSize);
+    }
+
+    // a program the ROM database knows gets its settings from there, unless the command line or
+    // the recompiled binary already chose them
+    memcpy(keymap, KEYMAP, sizeof(keymap));
+    float background[3], foreground[3];
+    memcpy(background, BG_COLOR, sizeof(background));
+    memcpy(foreground, PIXEL_COLOR, sizeof(foreground));
+    RomDatabase romdb;
+    if (!romdb.load(romdbPath) && strcmp(romdbPath, CHIP8_DEFAULT_ROMDB) != 0) {
+        std::cerr << "No ROM database at " << romdbPath << std::endl;
+    }
+    const RomProfile* profile = romdb.find(cpu.getROMHash());
+    printf("ROM hash: %016llx%s%s\n", (unsigned long long)cpu.getROMHash(),
+           profile != NULL ? ", in the ROM database as " : "", profile != NULL ? profile->name.c_str() : "");
+    if (profile != NULL) {
+        if (profile->hasQuirks && !quirksGiven && chip8AotProgram == NULL) { cpu.setQuirks(profile->quirks); }
+        if (profile->instructionsPerSecond != 0 && !ipsGiven) { cpu.setInstructionsPerSecond(profile->instructionsPerSecond); }
+        if (profile->hasKeys) {
+            // GLFW numbers letter and digit keys by their upper case ASCII codes
+            for (int k = 0; k < 16; k++) { keymap[k] = toupper(profile->keys[k]); }
+        }
+        if (profile->hasPalette) {
+            memcpy(background, profile->background, sizeof(background));
+            memcpy(foreground, profile->foreground, sizeof(foreground));
+        }
+    }
+
+    // a recorded run repeated without a window, with the settings it was recorded with
+    if (replayPath != NULL) {
+        Movie movie;
+        if (!movie.load(replayPath)) {
+            return 1;
+        }
+        if (seekFrame >= 0) {
+            return runSeek(cpu, movie, (uint64_t)seekFrame, (uint32_t)keyframeInterval);
+        }
+        return runReplay(cpu, movie, perf);
+    }
+
+    // a movie played in the window takes the place of the keyboard, indexed up front for seeking
+    Movie playMovie;
+    MoviePlayer* player = NULL;
+    if (playPath != NULL) {
+        if (!playMovie.load(playPath)) {
+            return 1;
+        }
+        player = new MoviePlayer(cpu, playMovie, (uint32_t)keyframeInterval);
+        if (!player->start()) {
+            delete player;
+            return 1;
+        }
+        player->buildIndex();
+        std::cout << "Playing " << player->frameCount() << " frames, indexed into "
+                  << player->keyframeCount() << " keyframes" << std::endl;
+    }
+
+    // no window at all, frames come from a virtual clock
+    if (headless) {
+        return runHeadless(cpu, headlessFrames, perf);
+    }
 
-    if (argc != 2) {
-        std::cout << "Usage: ./CHIP-8_Emulator ROMfile" << std::endl;
-        return 1;
-    }    
     // Initialize GLFW
     if (!glfwInit()) {
         std::cerr << "Failed to initialize GLFW" << std::endl;
@@ -83,6 +257,8 @@ int main(int argc, char **argv)
     }
     glfwMakeContextCurrent(window);
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    glfwSetWindowRefreshCallback(window, window_refresh_callback);
+    glfwSwapInterval(1); // frames that get drawn are paced by the display's refresh
 
     // glad: load all OpenGL function pointers
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
@@ -93,32 +269,84 @@ int main(int argc, char **argv)
 
     glDisable(GL_DEPTH_TEST); // Disable depth testing (working in 2D)
 
-    CPU cpu;
-    cpu.loadFile(argv[1]);
+    // deleted before glfwTerminate(), its GL objects need the context
+    Renderer* renderer = new Renderer();
+    if (!renderer->init(background, foreground)) {
+        std::cerr << "Failed to initialize renderer" << std::endl;
+        delete renderer;
+        glfwTerminate();
+        return -1;
+    }
+
+    // a missing sound device only costs the beep
+    AudioSink* sink = openAudioSink(audioOutput);
+    if (sink != NULL) {
+        audio = new Audio(sink);
+        audio->start();
+        cpu.setAudio(audio);
+    }
+
     std::cout << "ROM loaded, starting emulation..." << std::endl;
 
+    // the CPU runs on its own thread from here on, this one only handles input and drawing
+    Emulation emulation(cpu);
+    glfwSetWindowUserPointer(window, &emulation);
+    glfwSetKeyCallback(window, key_callback);
+    glfwSetWindowFocusCallback(window, window_focus_callback);
+    emulation.setFrameSkip((int)frameSkip);
+    emulation.setRewindFrames(player == NULL ? (size_t)rewindSeconds * 60 : 0);
+    emulation.setPlayer(player);
+    Movie movie;
+    if (recordPath != NULL) {
+        movie.begin(cpu);
+        emulation.setRecording(&movie);
+    }
+    emulation.setStatePath(std::string(romPath != NULL ? romPath : argv[0]) + ".state");
+    emulation.setTurbo(turbo);
+    if (audio != NULL) { audio->setRateLimit(turbo); }
+    emulation.start(glfwPostEmptyEvent);
+
    // render loop
+    Frame shown; // what the texture holds, to upload only the rows that differ
+    memset(shown.rows, 0, sizeof(shown.rows));
+    uint32_t staleRows = 0xFFFFFFFF;
     while (!glfwWindowShouldClose(window))
     {
-        // input
-        processInput(window, cpu);
+        // sleep until the emulation thread has published a frame, key events are handled in the meantime
+        glfwWaitEvents();
 
-        // render
-        glClearColor(BG_COLOR_R, BG_COLOR_G, BG_COLOR_B, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
-
-        for (int i = 0; i < CHIP8_INSTRUCTIONS_PER_FRAME; i++) {
-            cpu.Cycle(); // call opcode execution cycle, multiple times to control framerate
+        if (emulation.frames.update()) {
+            const Frame& latest = emulation.frames.readBuffer();
+            for (int y = 0; y < 32; y++) {
+                if (latest.rows[y] != shown.rows[y]) { staleRows |= 1u << y; }
+            }
+            renderer->upload(latest.rows, staleRows);
+            memcpy(shown.rows, latest.rows, sizeof(shown.rows));
+        } else if (!windowDamaged) {
+            continue;
         }
-        
-        renderChip8Display(cpu); // Render the CHIP-8 display
-
-        // Swap buffers and poll events
-        glfwSwapBuffers(window);
-        glfwPollEvents();        
 
+        // the quad covers the whole window so there is nothing to clear; the swap waits for the
+        // display, but only this thread, the emulation goes on meanwhile
+        if (staleRows != 0 || windowDamaged) {
+            renderer->draw();
+            glfwSwapBuffers(window);
+        }
+        staleRows = 0;
+        windowDamaged = false;
     }
 
+    emulation.stop();
+    if (timingStats) { emulation.reportTiming(); }
+    if (recordPath != NULL && movie.save(recordPath)) {
+        std::cout << "Recorded " << movie.events.size() << " keypad changes to " << recordPath << std::endl;
+    }
+    glfwSetKeyCallback(window, NULL);
+    glfwSetWindowFocusCallback(window, NULL);
+    cpu.setAudio(NULL);
+    delete audio;
+    delete player;
+    delete renderer;
     glfwTerminate();
     return 0;
 }
@@ -126,43 +354,60 @@ int main(int argc, char **argv)
 
 
 
-// Process keyboard input
-void processInput(GLFWwindow *window, CPU &cpu)
+// Process keyboard input as it happens: every press and release flips one bit of the keypad, so
+// any number of keys can be held at once and nothing is polled per frame
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+    Emulation* emulation = (Emulation*)glfwGetWindowUserPointer(window);
+    if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
+    // Tab switches turbo on and off
+    if (key == GLFW_KEY_TAB && action == GLFW_PRESS) {
+        bool turbo = !emulation->getTurbo();
+        emulation->setTurbo(turbo);
+        if (audio != NULL) audio->setRateLimit(turbo);
+    }
+    // F5 saves the whole machine next to the ROM, F9 goes back to it
+    if (key == GLFW_KEY_F5 && action == GLFW_PRESS)
+        emulation->requestSaveState();
+    if (key == GLFW_KEY_F9 && action == GLFW_PRESS)
+        emulation->requestLoadState();
+    // while a movie plays, Left and Right seek 10 seconds, Down and Up a minute, again and again
+    // while held, so a recording can be scrubbed through
+    if (action != GLFW_RELEASE) {
+        if (key == GLFW_KEY_LEFT) emulation->requestSeek(-600);
+        if (key == GLFW_KEY_RIGHT) emulation->requestSeek(600);
+        if (key == GLFW_KEY_DOWN) emulation->requestSeek(-3600);
+        if (key == GLFW_KEY_UP) emulation->requestSeek(3600);
+    }
+    if (action == GLFW_REPEAT)
+        return;
+    // Backspace runs time backwards for as long as it is held
+    if (key == GLFW_KEY_BACKSPACE)
+        emulation->setRewinding(action == GLFW_PRESS);
 
-    // Initialize keyPress to 0xFF (no key)
-    cpu.setKeyPress(0xFF); 
-
-    // CHIP-8 keypad layout:
-    // 1 2 3 C    maps to    1 2 3 4
-    // 4 5 6 D                Q W E R
-    // 7 8 9 E                A S D F
-    // A 0 B F                Z X C V
-
-    // Row 1
-    if (glfwGetKey(window, GLFW_KEY_1) == GLFW_PRESS) cpu.setKeyPress(0x1);
-    if (glfwGetKey(window, GLFW_KEY_2) == GLFW_PRESS) cpu.setKeyPress(0x2);
-    if (glfwGetKey(window, GLFW_KEY_3) == GLFW_PRESS) cpu.setKeyPress(0x3);
-    if (glfwGetKey(window, GLFW_KEY_4) == GLFW_PRESS) cpu.setKeyPress(0xC);
-    // Row 2  
-    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS) cpu.setKeyPress(0x4);
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) cpu.setKeyPress(0x5);
-    if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS) cpu.setKeyPress(0x6);
-    if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS) cpu.setKeyPress(0xD);
-    // Row 3    
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) cpu.setKeyPress(0x7);
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) cpu.setKeyPress(0x8);
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) cpu.setKeyPress(0x9);
-    if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS) cpu.setKeyPress(0xE);
-    // Row 4   
-    if (glfwGetKey(window, GLFW_KEY_Z) == GLFW_PRESS) cpu.setKeyPress(0xA);
-    if (glfwGetKey(window, GLFW_KEY_X) == GLFW_PRESS) cpu.setKeyPress(0x0);
-    if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS) cpu.setKeyPress(0xB);
-    if (glfwGetKey(window, GLFW_KEY_V) == GLFW_PRESS) cpu.setKeyPress(0xF);
+    for (uint8_t k = 0; k < 16; k++) {
+        if (keymap[k] == key) {
+            if (action == GLFW_PRESS) emulation->pressKey(k);
+            else emulation->releaseKey(k);
+        }
+    }
+}
+
+// Releases are not reported to a window without focus, so keys (and rewind) are let go of when it is lost
+void window_focus_callback(GLFWwindow* window, int focused)
+{
+    if (!focused) {
+        Emulation* emulation = (Emulation*)glfwGetWindowUserPointer(window);
+        emulation->releaseAllKeys();
+        emulation->setRewinding(false);
+    }
 }
 
 // Handle window resize
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
-{glViewport(0, 0, width, height);}
\ No newline at end of file
+{glViewport(0, 0, width, height); windowDamaged = true;}
+
+// Handle the window contents having to be drawn again, e.g. after being uncovered
+void window_refresh_callback(GLFWwindow* window)
+{windowDamaged = true;}
\ No newline at end of file
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <iostream>
+#include <cstring>
+#include "emulation.h"
+#include "cpu.h"
+#include "savestate.h"
+#include "rewind.h"
+#include "movie.h"
+
+// the most frames' worth of instructions one wake-up runs, so a host that cannot keep up, or
+// a thread that was suspended, drops the instructions it is behind by instead of stalling
+#define EMULATION_MAX_CATCHUP_FRAMES 4
+// bytes set aside per rewind frame, several times what a typical frame's delta takes
+#define EMULATION_REWIND_BYTES_PER_FRAME 512
+
+Emulation::Emulation(CPU& c) : cpu(c), running(false), keypad(0), onFrame(NULL), scheduler(60),
+                                   turbo(false), frameSkip(0), stateRequest(STATE_NONE),
+                                   history(NULL), recording(NULL), player(NULL), seekFrames(0),
+                                   rewinding(false), captures(0), captureTime(0), captureMax(0) {}
+
+Emulation::~Emulation(){
+    stop();
+    delete history;
+}
+
+void Emulation::setRewindFrames(size_t frames){
+    delete history;
+    history = (frames > 0) ? new RewindBuffer(frames, frames * EMULATION_REWIND_BYTES_PER_FRAME) : NULL;
+}
+
+void Emulation::reportTiming() const {
+    scheduler.report();
+    if (history != NULL && captures > 0) {
+        printf("Rewind: %zu frames in %zu KB, capture mean %.2f us, max %.2f us\n",
+               history->frames(), history->bytesUsed() / 1024, captureTime / 1e3 / captures, captureMax / 1e3);
+    }
+}
+
+void Emulation::start(void (*callback)()){
+    if (running.load()) {
+        return;
+    }
+    onFrame = callback;
+    // the first frame is shown in full
+    memcpy(frames.writeBuffer().rows, cpu.getFrame(), sizeof(Frame::rows));
+    frames.publish();
+    running.store(true);
+    thread = std::thread(&Emulation::run, this);
+}
+
+void Emulation::stop(){
+    running.store(false);
+    wake();
+    if (thread.joinable()) {
+        thread.join();
+    }
+    if (recording != NULL) {
+        recording->finish(cpu);
+        recording = NULL;
+    }
+}
+
+void Emulation::run(){
+    uint64_t ips = cpu.getInstructionsPerSecond();
+    uint64_t maxBudget = ips * EMULATION_MAX_CATCHUP_FRAMES / 60 + 1;
+    uint64_t executed = 0;
+    uint64_t turboFrame = 0;
+    uint32_t unpublishedRows = 0; // changed since the last published frame
+    captures = 0;
+    captureTime = 0;
+    captureMax = 0;
+    if (history != NULL) {
+        history->clear();
+        captureFrame();
+    }
+    scheduler.start();
+
+    while (running.load(std::memory_order_relaxed)) {
+        if (cpu.getInstructionsPerSecond() != ips) {
+            // a loaded state, or rewinding across one, brought another rate; the time so far is counted at it
+            uint64_t rate = cpu.getInstructionsPerSecond();
+            executed = executed / ips * rate + executed % ips * rate / ips;
+            ips = rate;
+            maxBudget = ips * EMULATION_MAX_CATCHUP_FRAMES / 60 + 1;
+        }
+        uint64_t budget;
+        bool publish;
+        bool stepBack = history != NULL && rewinding.load(std::memory_order_relaxed);
+        if (stepBack) {
+            // no instructions are owed for the time spent going back
+            executed = scheduler.waitForNextFrame() / 1000 * ips / 1000000;
+            budget = 0;
+            publish = true;
+        } else if (turbo.load(std::memory_order_relaxed)) {
+            budget = cpu.instructionsInFrame(turboFrame++);
+            publish = (frameSkip > 0) ? turboFrame % frameSkip == 0 : frames.taken();
+        } else {
+            // the last frame is already out, unless turbo was just turned off with one held back
+            if (player == NULL && unpublishedRows == 0 && cpu.waitingForInput()) {
+                waitForInput();
+                // no instructions are owed for the time spent asleep either
+                executed = scheduler.resume() / 1000 * ips / 1000000;
+            }
+            // the budget comes from the clock, not from counting wake-ups, so a late frame is made up by the next
+            uint64_t elapsed = scheduler.waitForNextFrame();
+            uint64_t due = elapsed / 1000 * ips / 1000000; // microseconds keep the product in range for days
+            budget = due - executed;
+            if (budget > maxBudget) {
+                // also where the clock picks up again after turbo
+                budget = maxBudget;
+                executed = due - budget;
+            }
+            executed += budget;
+            publish = true;
+        }
+
+        handleStateRequest();
+        if (stepBack) {
+            if (history->stepBack()) {
+                cpu.restore(history->current());
+                if (recording != NULL) { recording->truncate(cpu.getCycles()); }
+            }
+        } else if (player != NULL) {
+            int64_t seek = seekFrames.exchange(0, std::memory_order_relaxed);
+            if (seek != 0) {
+                int64_t frame = (int64_t)player->currentFrame() + seek;
+                player->seek(frame > 0 ? frame : 0);
+            }
+            player->runTo(cpu.getCycles() + budget);
+        } else {
+            uint16_t keys = keypad.load(std::memory_order_relaxed);
+            if (recording != NULL) { recording->record(cpu.getCycles(), keys); }
+            cpu.setKeypad(keys);
+            cpu.Run((int)budget);
+            if (history != NULL) { captureFrame(); }
+        }
+
+        // frames where the screen did not change are not published, so the renderer has nothing to do
+        unpublishedRows |= cpu.takeDirtyRows();
+        if (publish && unpublishedRows != 0) {
+            memcpy(frames.writeBuffer().rows, cpu.getFrame(), sizeof(Frame::rows));
+            frames.publish();
+            unpublishedRows = 0;
+            if (onFrame != NULL) { onFrame(); }
+        }
+    }
+}
+
+void Emulation::waitForInput(){
+    // a movie's keys come from the movie, so a player never gets here
+    uint16_t keys = cpu.getKeypad();
+    std::unique_lock<std::mutex> lock(wakeMutex);
+    while (running.load(std::memory_order_relaxed) && keypad.load(std::memory_order_relaxed) == keys &&
+           stateRequest.load(std::memory_order_relaxed) == STATE_NONE &&
+           !(history != NULL && rewinding.load(std::memory_order_relaxed))) {
+        wakeup.wait(lock);
+    }
+}
+
+void Emulation::captureFrame(){
+    uint64_t start = monotonicNanoseconds();
+    history->capture(cpu.snapshot());
+    uint64_t time = monotonicNanoseconds() - start;
+    captures++;
+    captureTime += time;
+    if (time > captureMax) { captureMax = time; }
+}
+
+void Emulation::handleStateRequest(){
+    uint8_t request = stateRequest.exchange(STATE_NONE, std::memory_order_relaxed);
+    if (request == STATE_SAVE) {
+        if (saveStateFile(statePath.c_str(), cpu.snapshot())) {
+            std::cout << "Saved state to " << statePath << std::endl;
+        }
+    } else if (request == STATE_LOAD && player != NULL) {
+        std::cout << "A saved state cannot be loaded while a movie plays" << std::endl;
+    } else if (request == STATE_LOAD) {
+        CPUState state;
+        if (loadStateFile(statePath.c_str(), state)) {
+            if (recording != NULL) {
+                recording->finish(cpu);
+                recording = NULL;
+                std::cout << "Recording ended, a loaded state is not part of the movie" << std::endl;
+            }
+            cpu.restore(state);
+            if (history != NULL) { captureFrame(); } // rewinding goes back from here to before the load
+            std::cout << "Loaded state from " << statePath << std::endl;
+        }
+    }
+}
@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <iostream>
+#include <chrono>
+#include "headless.h"
+#include "cpu.h"
+#include "perfcounters.h"
+
+uint64_t hashFrame(const uint64_t* frame){
+    uint64_t hash = 14695981039346656037ULL;
+    for (int y = 0; y < 32; y++) {
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            hash ^= (frame[y] >> shift) & 0xFF;
+            hash *= 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+static uint64_t hashValue(uint64_t hash, uint64_t value, int bytes){
+    for (int i = 0; i < bytes; i++) {
+        hash ^= (value >> (8 * i)) & 0xFF;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+uint64_t hashState(const CPUState& state){
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < 16; i++) { hash = hashValue(hash, state.V[i], 1); }
+    hash = hashValue(hash, state.I, 2);
+    hash = hashValue(hash, state.PC, 2);
+    hash = hashValue(hash, state.SP, 1);
+    for (int i = 0; i < 16; i++) { hash = hashValue(hash, state.stack[i], 2); }
+    for (int i = 0; i < 4096; i++) { hash = hashValue(hash, state.RAM[i], 1); }
+    for (int y = 0; y < 32; y++) { hash = hashValue(hash, state.display[y], 8); }
+    hash = hashValue(hash, state.cycles, 8);
+    hash = hashValue(hash, state.instructionsPerSecond, 4);
+    hash = hashValue(hash, state.tickBase, 8);
+    hash = hashValue(hash, state.cycleBase, 8);
+    hash = hashValue(hash, state.delayEnd, 8);
+    hash = hashValue(hash, state.soundEnd, 8);
+    hash = hashValue(hash, state.keypad, 2);
+    hash = hashValue(hash, state.waitingForKeyRelease, 1);
+    hash = hashValue(hash, state.lastKey, 1);
+    hash = hashValue(hash, state.rng.getState(), 8);
+    hash = hashValue(hash, state.seed, 8);
+    return hash;
+}
+
+int runHeadless(CPU& cpu, long frames, bool perf){
+    cpu.setAudio(NULL);
+    PerfCounters counters;
+    if (perf && !counters.anyAvailable()) {
+        std::cerr << "No hardware performance counters are available" << std::endl;
+    }
+
+    // the clock is virtual, so every frame starts as soon as the previous one is done
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (perf) { counters.start(); }
+    long long instructions = 0;
+    for (long frame = 0; frame < frames; frame++) {
+        int count = cpu.instructionsInFrame(frame);
+        cpu.Run(count);
+        instructions += count;
+    }
+    if (perf) { counters.stop(); }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("Ran %ld frames (%.2f s of emulated time, %lld instructions) in %.6f s\n",
+           frames, frames / 60.0, instructions, seconds);
+    if (seconds > 0) {
+        printf("Instructions/s: %.0f\n", instructions / seconds);
+        printf("Frames/s: %.0f\n", frames / seconds);
+    }
+    printf("Framebuffer hash: %016llx (seed %llu)\n", (unsigned long long)hashFrame(cpu.getFrame()),
+           (unsigned long long)cpu.getSeed());
+    if (perf) {
+        counters.report(instructions, frames);
+    }
+    return 0;
+}
@@ -0,0 +1,599 @@
+#include <iostream>
+#include "jit.h"
+#include "cpu.h"
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define CHIP8_JIT_SUPPORTED 1
+#include <sys/mman.h>
+#endif
+
+#define JIT_CODE_SIZE (1 << 20)        // generated code kept before everything is flushed
+#define JIT_MAX_BLOCK_INSTRUCTIONS 64  // longest run of CHIP-8 instructions in one block
+#define JIT_MAX_BLOCK_BYTES 16384      // upper bound for the machine code of one block
+
+// the dispatcher indexes the block table by shifting PC
+static_assert(sizeof(JitBlock) == 16 && offsetof(JitBlock, code) == 0, "JitBlock layout is used by the generated code");
+
+namespace {
+
+// x86-64 registers, numbered the way they are encoded
+enum HostReg { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// Inside the generated code RBX points at the CPUState and R12 holds what is left of the
+// instruction budget, RAX, RCX and RDX are scratch and the rest can hold a V register for the
+// length of a block. The entry code saves the callee-saved ones once for all the blocks it runs.
+const uint8_t allocatable[] = { RSI, RDI, R8, R9, R10, R11, RBP, R13, R14, R15 };
+const int ALLOCATABLE_COUNT = sizeof(allocatable);
+
+// condition codes for setcc/cmovcc/jcc
+enum Cond { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_LE = 0xE };
+
+// opcodes of the "op r/m8, r8" forms
+enum Alu8 { ALU_ADD = 0x00, ALU_OR = 0x08, ALU_AND = 0x20, ALU_SUB = 0x28, ALU_XOR = 0x30, ALU_CMP = 0x38, MOV_8 = 0x88 };
+
+// Writes x86-64 machine code into a buffer. Every 8-bit operation carries a REX prefix
+// so that register numbers 4-7 mean SPL/BPL/SIL/DIL and 8-15 mean R8B-R15B.
+class Emitter {
+public:
+    uint8_t buffer [JIT_MAX_BLOCK_BYTES];
+    size_t size;
+    const uint8_t* origin; // where the buffer is copied to, jumps out of it are relative to that
+
+    explicit Emitter(const uint8_t* at) : size(0), origin(at) {}
+
+    void byte(uint8_t b) { buffer[size++] = b; }
+    void imm16(uint16_t v) { byte(v & 0xFF); byte(v >> 8); }
+    void imm32(uint32_t v) { imm16(v & 0xFFFF); imm16(v >> 16); }
+    void imm64(uint64_t v) { imm32(v & 0xFFFFFFFF); imm32(v >> 32); }
+
+    void rex(uint8_t reg, uint8_t rm) { byte(0x40 | ((reg >> 3) << 2) | (rm >> 3)); }
+    void modrm(uint8_t mod, uint8_t reg, uint8_t rm) { byte((mod << 6) | ((reg & 7) << 3) | (rm & 7)); }
+    // [rbx + disp], a field of the CPUState
+    void field(uint8_t reg, size_t disp) {
+        if (disp < 0x80) { modrm(1, reg, RBX); byte(disp); } else { modrm(2, reg, RBX); imm32(disp); }
+    }
+    // [rbx + rcx*2 + disp], an entry of the stack
+    void stackEntry(uint8_t reg, size_t disp) {
+        if (disp < 0x80) { modrm(1, reg, RSP); byte(0x4B); byte(disp); } else { modrm(2, reg, RSP); byte(0x4B); imm32(disp); }
+    }
+
+    void push(uint8_t r) { if (r >= 8) { byte(0x41); } byte(0x50 + (r & 7)); }
+    void pop(uint8_t r) { if (r >= 8) { byte(0x41); } byte(0x58 + (r & 7)); }
+
+    // mov r8, V[v] and mov V[v], r8
+    void loadV(uint8_t r, uint8_t v) { rex(r, RBX); byte(0x8A); field(r, offsetof(CPUState, V) + v); }
+    void storeV(uint8_t v, uint8_t r) { rex(r, RBX); byte(0x88); field(r, offsetof(CPUState, V) + v); }
+
+    // op dst8, src8
+    void alu(Alu8 op, uint8_t dst, uint8_t src) { rex(src, dst); byte(op); modrm(3, src, dst); }
+    // op dst8, imm8 where digit is the /digit of the 0x80 group (add 0, or 1, and 4, sub 5, xor 6, cmp 7)
+    void aluImm(uint8_t digit, uint8_t dst, uint8_t imm) { rex(0, dst); byte(0x80); modrm(3, digit, dst); byte(imm); }
+    void movImm(uint8_t dst, uint8_t imm) { rex(0, dst); byte(0xB0 + (dst & 7)); byte(imm); }
+    // movzx dst32, src8
+    void movzx(uint8_t dst, uint8_t src) { rex(dst, src); byte(0x0F); byte(0xB6); modrm(3, dst, src); }
+
+    // shl/shr r8, imm8 (digit 4 and 5 of the 0xC0 group)
+    void shift(uint8_t digit, uint8_t r, uint8_t count) { rex(0, r); byte(0xC0); modrm(3, digit, r); byte(count); }
+    void setcc(Cond cc, uint8_t r) { rex(0, r); byte(0x0F); byte(0x90 + cc); modrm(3, 0, r); }
+
+    // mov word [field], imm16
+    void storeImm16(size_t disp, uint16_t value) { byte(0x66); byte(0xC7); field(0, disp); imm16(value); }
+    // movzx ecx, r8 ; add word I, cx
+    void addI(uint8_t r) { movzx(RCX, r); byte(0x66); byte(0x01); field(RCX, offsetof(CPUState, I)); }
+    // movzx eax, r8 ; lea eax, [rax + rax*4 + 0x50] ; mov word I, ax
+    void fontI(uint8_t r) {
+        movzx(RAX, r);
+        byte(0x8D); byte(0x44); byte(0x80); byte(0x50);
+        byte(0x66); byte(0x89); field(RAX, offsetof(CPUState, I));
+    }
+
+    // add qword cycles, imm8 and add qword cycles, rcx
+    void addCycles(uint8_t count) { byte(0x48); byte(0x83); field(0, offsetof(CPUState, cycles)); byte(count); }
+    void addCyclesEcx() { byte(0x48); byte(0x01); field(RCX, offsetof(CPUState, cycles)); }
+    // cmp r12d, imm8 and sub r12d, edx
+    void cmpBudget(uint8_t count) { byte(0x41); byte(0x83); byte(0xFC); byte(count); }
+    void subBudgetEdx() { byte(0x41); byte(0x29); byte(0xD4); }
+
+    // CALL, pushes the address of the instruction: movzx ecx, byte SP ; mov word stack[rcx], imm16 ; inc byte SP
+    void pushStack(uint16_t address) {
+        byte(0x0F); byte(0xB6); field(RCX, offsetof(CPUState, SP));
+        byte(0x66); byte(0xC7); stackEntry(0, offsetof(CPUState, stack)); imm16(address);
+        byte(0xFE); field(0, offsetof(CPUState, SP));
+    }
+    // RET, pops into eax and returns where to jump if the stack was empty:
+    // movzx ecx, byte SP ; test ecx, ecx ; jz empty ; dec ecx ; mov byte SP, cl ;
+    // movzx eax, word stack[rcx] ; add eax, 2 ; movzx eax, ax
+    size_t popStack() {
+        byte(0x0F); byte(0xB6); field(RCX, offsetof(CPUState, SP));
+        byte(0x85); byte(0xC9);
+        size_t empty = jcc(CC_E);
+        byte(0xFF); byte(0xC9);
+        byte(0x88); field(RCX, offsetof(CPUState, SP));
+        byte(0x0F); byte(0xB7); stackEntry(RAX, offsetof(CPUState, stack));
+        byte(0x83); byte(0xC0); byte(0x02);
+        byte(0x0F); byte(0xB7); byte(0xC0);
+        return empty;
+    }
+    // FX0A, sets ZF if a key is down or one is waiting to be released:
+    // cmp byte waitingForKeyRelease, 0 ; jne ... ; cmp word keypad, 0
+    size_t testKeyWait() {
+        byte(0x80); field(7, offsetof(CPUState, waitingForKeyRelease)); byte(0);
+        size_t waiting = jcc(CC_NE);
+        byte(0x66); byte(0x83); field(7, offsetof(CPUState, keypad)); byte(0);
+        return waiting;
+    }
+    // eax = PC + 2: movzx eax, word PC ; add eax, 2 ; movzx eax, ax
+    void loadNextPC() {
+        byte(0x0F); byte(0xB7); field(RAX, offsetof(CPUState, PC));
+        byte(0x83); byte(0xC0); byte(0x02);
+        byte(0x0F); byte(0xB7); byte(0xC0);
+    }
+    // sets CF to whether the key in r8 is held: movzx ecx, r8 ; and ecx, 15 ; movzx edx, word keypad ; bt edx, ecx
+    void testKey(uint8_t r) {
+        movzx(RCX, r);
+        byte(0x83); byte(0xE1); byte(0x0F);
+        byte(0x0F); byte(0xB7); field(RDX, offsetof(CPUState, keypad));
+        byte(0x0F); byte(0xA3); modrm(3, RCX, RDX);
+    }
+
+    // mov rdi, rbx ; mov rsi, op ; mov rax, helper ; call rax
+    void callHelper(Jit::Helper helper, const DecodedOp& op) {
+        uint64_t packed = 0;
+        memcpy(&packed, &op, sizeof(op)); // the helper takes it by value, which the ABI passes in rsi
+        byte(0x48); byte(0x89); byte(0xDF);
+        byte(0x48); byte(0xBE); imm64(packed);
+        byte(0x48); byte(0xB8); imm64((uint64_t)(uintptr_t)helper);
+        byte(0xFF); byte(0xD0);
+    }
+
+    void movEax(uint32_t v) { byte(0xB8); imm32(v); }
+    void movEcx(uint32_t v) { byte(0xB9); imm32(v); }
+    void movEdx(uint32_t v) { byte(0xBA); imm32(v); }
+    // add eax, imm32
+    void addEax(uint32_t v) { byte(0x05); imm32(v); }
+    void cmovEaxEcx(Cond cc) { byte(0x0F); byte(0x40 + cc); modrm(3, RAX, RCX); }
+
+    // jcc/jmp rel32 to a label placed later with bind(), they return where the offset goes
+    size_t jcc(Cond cc) { byte(0x0F); byte(0x80 + cc); imm32(0); return size - 4; }
+    size_t jmp() { byte(0xE9); imm32(0); return size - 4; }
+    void bind(size_t jump) {
+        uint32_t rel = (uint32_t)(size - (jump + 4));
+        memcpy(buffer + jump, &rel, 4);
+    }
+    // jmp rel32 to code that is already in place
+    void jumpTo(const uint8_t* target) {
+        byte(0xE9);
+        imm32((uint32_t)(target - (origin + size + 4)));
+    }
+    void ret() { byte(0xC3); }
+};
+
+uint16_t bit(uint8_t v) { return 1 << v; }
+
+// Where a block stops when the budget runs out before one of its instructions.
+struct BudgetExit {
+    size_t jump;
+    uint16_t pc;
+    uint8_t executed, synced; // instructions done before it, and how many of them cycles already counts
+};
+
+}
+
+Jit::Jit(Helper execute){
+    code = NULL;
+    codeSize = JIT_CODE_SIZE;
+    codeUsed = 0;
+    runtimeSize = 0;
+    entry = NULL;
+    dispatch = 0;
+    helper = execute;
+    quirks = quirkFlags(QUIRKS_DEFAULT);
+    idleSkipping = true;
+#ifdef CHIP8_JIT_SUPPORTED
+    void* mem = mmap(NULL, codeSize, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem != MAP_FAILED) {
+        code = (uint8_t*)mem;
+        emitRuntime();
+    }
+#endif
+    flush();
+}
+
+Jit::~Jit(){
+#ifdef CHIP8_JIT_SUPPORTED
+    if (code != NULL) { munmap(code, codeSize); }
+#endif
+}
+
+void Jit::flush() {
+    memset(blocks, 0, sizeof(blocks));
+    memset(covered, 0, sizeof(covered));
+    codeUsed = runtimeSize;
+}
+
+void Jit::setQuirks(const QuirkFlags& flags) {
+    quirks = flags;
+    flush();
+}
+
+void Jit::setIdleSkipping(bool enabled) {
+    idleSkipping = enabled;
+    flush();
+}
+
+void Jit::invalidate(uint16_t address) {
+    if (address >= 4096 || !covered[address]) {
+        return;
+    }
+    // self-modifying code is rare, so a linear sweep over the block table is fine
+    for (int a = 0; a < 4096; ++a) {
+        if (blocks[a].translated && blocks[a].start <= address && address < blocks[a].end) {
+            blocks[a].translated = false;
+            blocks[a].code = NULL;
+        }
+    }
+}
+
+// The code in front of the blocks. entry(state, instructions) sets up the registers the blocks
+// expect and falls into the dispatcher, which every block jumps back to with the next PC in eax.
+// It goes on to the block translated for that PC, or returns to the caller if there is none yet
+// or the budget is spent, so a whole Run() can stay in native code without a call per block.
+void Jit::emitRuntime() {
+#ifdef CHIP8_JIT_SUPPORTED
+    Emitter e(code);
+    const uint8_t saved[] = { RBX, RBP, R12, R13, R14, R15 };
+    for (size_t i = 0; i < sizeof(saved); ++i) { e.push(saved[i]); }
+    e.byte(0x48); e.byte(0x83); e.byte(0xEC); e.byte(0x08); // sub rsp, 8, so calls from blocks see an aligned stack
+    e.byte(0x48); e.byte(0x89); e.byte(0xFB);               // mov rbx, rdi
+    e.byte(0x41); e.byte(0x89); e.byte(0xF4);               // mov r12d, esi
+    e.byte(0x0F); e.byte(0xB7); e.field(RAX, offsetof(CPUState, PC)); // movzx eax, word PC
+
+    dispatch = e.size;
+    e.byte(0x45); e.byte(0x85); e.byte(0xE4);               // test r12d, r12d
+    size_t spent = e.jcc(CC_LE);
+    e.byte(0x89); e.byte(0xC2);                             // mov edx, eax
+    e.byte(0x81); e.byte(0xE2); e.imm32(0xFFF);             // and edx, 0xFFF
+    e.byte(0xC1); e.byte(0xE2); e.byte(0x04);               // shl edx, 4
+    e.byte(0x48); e.byte(0xB9); e.imm64((uint64_t)(uintptr_t)blocks); // mov rcx, blocks
+    e.byte(0x48); e.byte(0x01); e.byte(0xCA);               // add rdx, rcx
+    e.byte(0x48); e.byte(0x8B); e.byte(0x0A);               // mov rcx, [rdx]
+    e.byte(0x48); e.byte(0x85); e.byte(0xC9);               // test rcx, rcx
+    size_t untranslated = e.jcc(CC_E);
+    e.byte(0x66); e.byte(0x3B); e.byte(0x42); e.byte(offsetof(JitBlock, start)); // cmp ax, [rdx + start]
+    size_t otherStart = e.jcc(CC_NE);
+    e.byte(0xFF); e.byte(0xE1);                             // jmp rcx
+
+    e.bind(spent);
+    e.bind(untranslated);
+    e.bind(otherStart);
+    e.byte(0x66); e.byte(0x89); e.field(RAX, offsetof(CPUState, PC)); // mov word PC, ax
+    e.byte(0x44); e.byte(0x89); e.byte(0xE0);               // mov eax, r12d
+    e.byte(0x48); e.byte(0x83); e.byte(0xC4); e.byte(0x08); // add rsp, 8
+    for (size_t i = sizeof(saved); i > 0; --i) { e.pop(saved[i - 1]); }
+    e.ret();
+
+    if (mprotect(code, codeSize, PROT_READ | PROT_WRITE) != 0) {
+        return;
+    }
+    memcpy(code, e.buffer, e.size);
+    mprotect(code, codeSize, PROT_READ | PROT_EXEC);
+    runtimeSize = e.size;
+    entry = (Entry)code;
+#endif
+}
+
+void Jit::translate(const uint8_t* RAM, uint16_t pc, JitBlock& block) {
+#ifdef CHIP8_JIT_SUPPORTED
+    // blocks are emitted in place, so there has to be room for the longest one
+    if (entry != NULL && codeUsed + JIT_MAX_BLOCK_BYTES > codeSize) {
+        flush();
+    }
+#endif
+    block.translated = true;
+    block.code = NULL;
+    block.start = pc;
+    block.end = pc + 2; // an interpreted entry still depends on the instruction at pc
+    block.instructions = 0;
+    // like the predecode cache, only program memory is translated, an overflowing stack runs
+    // into the memory below 0x200 without going through writeRAM()
+    if (pc < 0x200 || pc >= 0xFFF) {
+        return;
+    }
+    covered[pc] = covered[pc + 1] = true;
+#ifdef CHIP8_JIT_SUPPORTED
+    if (entry == NULL) {
+        return;
+    }
+
+    // First pass: collect the instructions of the block and give each V register they touch a host register.
+    // The block stops after a jump, skip, call or return, after FX0A, and after a store to memory, which could
+    // overwrite what follows. Instructions without native code call the interpreter for just that instruction.
+    DecodedOp ops [JIT_MAX_BLOCK_INSTRUCTIONS];
+    uint16_t opWrites [JIT_MAX_BLOCK_INSTRUCTIONS];
+    int count = 0;
+    int8_t host [16];
+    memset(host, -1, sizeof(host));
+    int used = 0;
+    uint16_t written = 0;
+    bool terminated = false;
+    uint16_t address = pc;
+
+    while (count < JIT_MAX_BLOCK_INSTRUCTIONS && address < 0xFFF && !terminated) {
+        DecodedOp op = CPU::decodeAt(RAM, address);
+        if (op.handler == OP_JP_SELF || op.handler == OP_WAIT_DT || op.handler == OP_LD_VX_K) {
+            // idle loops are left to the interpreter, which skips them, unless that is turned off
+            if (idleSkipping) {
+                break;
+            }
+            if (op.handler == OP_JP_SELF) { op.handler = OP_JP; }
+            if (op.handler == OP_WAIT_DT) { op.handler = OP_LD_VX_DT; }
+        }
+        uint16_t reads = 0, writes = 0;
+        bool compilable = true;
+        switch (op.handler) {
+        case OP_NOP:
+        case OP_LD_I:
+        case OP_CLS:
+        case OP_RND:
+        case OP_DRW:
+        case OP_LD_VX_DT:
+        case OP_LD_DT_VX:
+        case OP_LD_ST_VX:
+        case OP_LD_VX_MEM:
+            break;
+        case OP_LD_NN:
+        case OP_ADD_NN:
+            writes = bit(op.X);
+            break;
+        case OP_ADD_I:
+        case OP_LD_F:
+            reads = bit(op.X);
+            break;
+        case OP_LD_VY:
+            reads = bit(op.Y);
+            writes = bit(op.X);
+            break;
+        case OP_OR:
+        case OP_AND:
+        case OP_XOR:
+            reads = bit(op.Y);
+            writes = bit(op.X) | (quirks.logicResetsVF ? bit(0xF) : 0);
+            break;
+        case OP_ADD_VY:
+        case OP_SUB:
+        case OP_SUBN:
+            reads = bit(op.Y);
+            writes = bit(op.X) | bit(0xF);
+            break;
+        case OP_SHR:
+        case OP_SHL:
+            reads = quirks.shiftUsesVY ? bit(op.Y) : 0;
+            writes = bit(op.X) | bit(0xF);
+            break;
+        case OP_JP:
+        case OP_CALL:
+        case OP_RET:
+        case OP_LD_VX_K:
+        case OP_LD_B:
+        case OP_LD_MEM_VX:
+            terminated = true;
+            break;
+        case OP_JP_V0:
+            reads = bit(quirks.jumpUsesVX ? op.X : 0);
+            terminated = true;
+            break;
+        case OP_SE_NN:
+        case OP_SNE_NN:
+        case OP_SKP:
+        case OP_SKNP:
+            reads = bit(op.X);
+            terminated = true;
+            break;
+        case OP_SE_VY:
+        case OP_SNE_VY:
+            reads = bit(op.X) | bit(op.Y);
+            terminated = true;
+            break;
+        default:
+            compilable = false;
+            break;
+        }
+        if (!compilable) {
+            break;
+        }
+
+        // the block ends early once it runs out of host registers
+        uint16_t regs = reads | writes;
+        int extra = 0;
+        for (int v = 0; v < 16; ++v) {
+            if ((regs & bit(v)) && host[v] < 0) { ++extra; }
+        }
+        if (used + extra > ALLOCATABLE_COUNT) {
+            terminated = false;
+            break;
+        }
+        for (int v = 0; v < 16; ++v) {
+            if ((regs & bit(v)) && host[v] < 0) { host[v] = allocatable[used++]; }
+        }
+        written |= writes;
+        opWrites[count] = writes;
+        ops[count++] = op;
+        address += 2;
+    }
+
+    if (count == 0) {
+        return; // the first instruction has to be interpreted
+    }
+
+    // Second pass: emit the block. Before an instruction that goes to the interpreter, the V registers
+    // changed since the last such call are stored and cycles is brought up to date, afterwards every
+    // V register the block holds is loaded again. The exit at the end stores the rest, counts the
+    // instructions and jumps back to the dispatcher with the next PC in eax.
+    Emitter e(code + codeUsed);
+    for (int v = 0; v < 16; ++v) {
+        if (host[v] >= 0) { e.loadV(host[v], v); }
+    }
+
+    BudgetExit exits [JIT_MAX_BLOCK_INSTRUCTIONS];
+    int exitCount = 0;
+    int synced = 0;        // instructions already added to cycles
+    uint16_t dirty = 0;    // V registers changed in host registers since the last call to the interpreter
+    bool nextSet = false;  // the last instruction put the next PC in eax
+    bool returns = false;  // the block ends in a return
+    size_t emptyStack = 0; // its jump taken with nothing on the stack
+
+    for (int i = 0; i < count; ++i) {
+        const DecodedOp& op = ops[i];
+        uint16_t at = pc + 2 * i;
+        uint8_t vx = host[op.X], vy = host[op.Y], vf = host[0xF];
+        if (i > 0) {
+            // the instructions so far may have used up the budget
+            e.cmpBudget(i);
+            BudgetExit exit = { e.jcc(CC_E), at, (uint8_t)i, (uint8_t)synced };
+            exits[exitCount++] = exit;
+        }
+        switch (op.handler) {
+        case OP_LD_NN: e.movImm(vx, op.NN); break;
+        case OP_ADD_NN: e.aluImm(0, vx, op.NN); break;
+        case OP_LD_VY: e.alu(MOV_8, vx, vy); break;
+        case OP_OR: e.alu(ALU_OR, vx, vy); if (quirks.logicResetsVF) { e.movImm(vf, 0); } break;
+        case OP_AND: e.alu(ALU_AND, vx, vy); if (quirks.logicResetsVF) { e.movImm(vf, 0); } break;
+        case OP_XOR: e.alu(ALU_XOR, vx, vy); if (quirks.logicResetsVF) { e.movImm(vf, 0); } break;
+        // VF is written before VX and later reads see the new VF, in the same order as the interpreter
+        case OP_ADD_VY:
+            e.alu(MOV_8, RAX, vx); e.alu(ALU_ADD, RAX, vy); e.setcc(CC_B, RDX);
+            e.alu(MOV_8, vf, RDX); e.alu(MOV_8, vx, RAX);
+            break;
+        case OP_SUB:
+            e.alu(ALU_CMP, vx, vy); e.setcc(CC_AE, RDX); e.alu(MOV_8, vf, RDX);
+            e.alu(ALU_SUB, vx, vy);
+            break;
+        case OP_SUBN:
+            e.alu(ALU_CMP, vy, vx); e.setcc(CC_AE, RDX); e.alu(MOV_8, vf, RDX);
+            e.alu(MOV_8, RAX, vy); e.alu(ALU_SUB, RAX, vx); e.alu(MOV_8, vx, RAX);
+            break;
+        case OP_SHR:
+            if (quirks.shiftUsesVY) { e.alu(MOV_8, vx, vy); }
+            e.alu(MOV_8, RDX, vx); e.aluImm(4, RDX, 0x01); e.alu(MOV_8, vf, RDX);
+            e.shift(5, vx, 1);
+            break;
+        case OP_SHL:
+            if (quirks.shiftUsesVY) { e.alu(MOV_8, vx, vy); }
+            e.alu(MOV_8, RDX, vx); e.shift(5, RDX, 7); e.alu(MOV_8, vf, RDX);
+            e.shift(4, vx, 1);
+            break;
+        case OP_LD_I: e.storeImm16(offsetof(CPUState, I), op.NNN); break;
+        case OP_ADD_I: e.addI(vx); break;
+        case OP_LD_F: e.fontI(vx); break;
+        case OP_JP: e.movEax(op.NNN); nextSet = true; break;
+        case OP_CALL: e.pushStack(at); e.movEax(op.NNN); nextSet = true; break;
+        case OP_RET: emptyStack = e.popStack(); returns = true; nextSet = true; break;
+        case OP_JP_V0: e.movzx(RAX, host[quirks.jumpUsesVX ? op.X : 0]); e.addEax(op.NNN); nextSet = true; break;
+        // skips pick the next PC with a cmov on the flags of the test, the stores after it leave eax alone
+        case OP_SE_NN: e.aluImm(7, vx, op.NN); e.movEax(at + 2); e.movEcx(at + 4); e.cmovEaxEcx(CC_E); nextSet = true; break;
+        case OP_SNE_NN: e.aluImm(7, vx, op.NN); e.movEax(at + 2); e.movEcx(at + 4); e.cmovEaxEcx(CC_NE); nextSet = true; break;
+        case OP_SE_VY: e.alu(ALU_CMP, vx, vy); e.movEax(at + 2); e.movEcx(at + 4); e.cmovEaxEcx(CC_E); nextSet = true; break;
+        case OP_SNE_VY: e.alu(ALU_CMP, vx, vy); e.movEax(at + 2); e.movEcx(at + 4); e.cmovEaxEcx(CC_NE); nextSet = true; break;
+        case OP_SKP: e.testKey(vx); e.movEax(at + 2); e.movEcx(at + 4); e.cmovEaxEcx(CC_B); nextSet = true; break;
+        case OP_SKNP: e.testKey(vx); e.movEax(at + 2); e.movEcx(at + 4); e.cmovEaxEcx(CC_AE); nextSet = true; break;
+        case OP_NOP: break;
+        case OP_LD_VX_K: {
+            // PC stays put while no key is down, the interpreter handles the rest and moves PC itself
+            for (int v = 0; v < 16; ++v) {
+                if (dirty & bit(v)) { e.storeV(v, host[v]); }
+            }
+            dirty = 0;
+            if (i > synced) {
+                e.addCycles(i - synced);
+                synced = i;
+            }
+            size_t waiting = e.testKeyWait();
+            size_t pressed = e.jcc(CC_NE);
+            e.movEax(at);
+            size_t done = e.jmp();
+            e.bind(waiting);
+            e.bind(pressed);
+            e.storeImm16(offsetof(CPUState, PC), at);
+            e.callHelper(helper, op);
+            for (int v = 0; v < 16; ++v) {
+                if (host[v] >= 0) { e.loadV(host[v], v); }
+            }
+            e.loadNextPC();
+            e.bind(done);
+            nextSet = true;
+            break;
+        }
+        default:
+            // the display, timers, random numbers and memory go through the interpreter
+            for (int v = 0; v < 16; ++v) {
+                if (dirty & bit(v)) { e.storeV(v, host[v]); }
+            }
+            dirty = 0;
+            if (i > synced) {
+                e.addCycles(i - synced);
+                synced = i;
+            }
+            e.callHelper(helper, op);
+            for (int v = 0; v < 16; ++v) {
+                if (host[v] >= 0) { e.loadV(host[v], v); }
+            }
+            break;
+        }
+        dirty |= opWrites[i];
+    }
+    if (!nextSet) {
+        e.movEax(address);
+    }
+    e.movEcx(count - synced);
+    e.movEdx(count);
+
+    // eax is the next PC, ecx the instructions cycles does not count yet and edx all the instructions run
+    size_t exitCode = e.size;
+    for (int v = 0; v < 16; ++v) {
+        if (written & bit(v)) { e.storeV(v, host[v]); }
+    }
+    e.addCyclesEcx();
+    e.subBudgetEdx();
+    e.jumpTo(code + dispatch);
+
+    for (int i = 0; i < exitCount; ++i) {
+        e.bind(exits[i].jump);
+        e.movEax(exits[i].pc);
+        e.movEcx(exits[i].executed - exits[i].synced);
+        e.movEdx(exits[i].executed);
+        e.jumpTo(e.origin + exitCode);
+    }
+    if (returns) {
+        // the interpreter reports the underflow, with PC on the return like it would be there
+        uint16_t returnAt = address - 2;
+        e.bind(emptyStack);
+        for (int v = 0; v < 16; ++v) {
+            if (written & bit(v)) { e.storeV(v, host[v]); }
+        }
+        e.storeImm16(offsetof(CPUState, PC), returnAt);
+        e.callHelper(helper, ops[count - 1]);
+        for (int v = 0; v < 16; ++v) {
+            if (host[v] >= 0) { e.loadV(host[v], v); }
+        }
+        e.movEax(returnAt + 2);
+        e.movEcx(count - synced);
+        e.movEdx(count);
+        e.jumpTo(e.origin + exitCode);
+    }
+
+    // copy the block into executable memory
+    if (mprotect(code, codeSize, PROT_READ | PROT_WRITE) != 0) {
+        return;
+    }
+    memcpy(code + codeUsed, e.buffer, e.size);
+    mprotect(code, codeSize, PROT_READ | PROT_EXEC);
+
+    block.code = code + codeUsed;
+    block.end = address;
+    block.instructions = count;
+    codeUsed += e.size;
+    for (uint16_t a = pc; a < address; ++a) {
+        covered[a] = true;
+    }
+#endif
+}
@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include "movie.h"
+#include "cpu.h"
+#include "headless.h"
+#include "perfcounters.h"
+
+#define MOVIE_MAGIC "CH8MOVIE"
+#define MOVIE_HEADER_SIZE 56
+
+static void put32(uint8_t* p, uint32_t v) { for (int i = 0; i < 4; i++) { p[i] = v >> (8 * i); } }
+static void put64(uint8_t* p, uint64_t v) { for (int i = 0; i < 8; i++) { p[i] = v >> (8 * i); } }
+static uint32_t get32(const uint8_t* p) { uint32_t v = 0; for (int i = 0; i < 4; i++) { v |= (uint32_t)p[i] << (8 * i); } return v; }
+static uint64_t get64(const uint8_t* p) { uint64_t v = 0; for (int i = 0; i < 8; i++) { v |= (uint64_t)p[i] << (8 * i); } return v; }
+
+Movie::Movie() : romHash(0), seed(0), quirks(QUIRKS_DEFAULT), instructionsPerSecond(0), length(0), finalHash(0) {}
+
+void Movie::begin(const CPU& cpu){
+    romHash = cpu.getROMHash();
+    seed = cpu.getSeed();
+    quirks = cpu.getQuirks();
+    instructionsPerSecond = cpu.getInstructionsPerSecond();
+    length = 0;
+    finalHash = 0;
+    events.clear();
+    events.reserve(4096); // growing the list is then rare while recording
+}
+
+void Movie::record(uint64_t cycle, uint16_t keypad){
+    if (!events.empty() && events.back().cycle == cycle) {
+        // no instruction ran with the last change, so this one takes its place
+        events.pop_back();
+    }
+    // the keypad starts out empty
+    if (keypad == (events.empty() ? 0 : events.back().keypad)) {
+        return;
+    }
+    MovieEvent event = { cycle, keypad };
+    events.push_back(event);
+}
+
+void Movie::truncate(uint64_t cycle){
+    while (!events.empty() && events.back().cycle > cycle) {
+        events.pop_back();
+    }
+}
+
+void Movie::finish(const CPU& cpu){
+    length = cpu.getCycles();
+    truncate(length);
+    // after going back in time the CPU can be left with the keypad of the frame it went back to
+    record(length, cpu.getKeypad());
+    finalHash = hashState(cpu.snapshot());
+}
+
+bool Movie::save(const char* path) const {
+    std::vector<uint8_t> bytes(MOVIE_HEADER_SIZE);
+    memcpy(&bytes[0], MOVIE_MAGIC, 8);
+    put32(&bytes[8], VERSION);
+    put64(&bytes[12], romHash);
+    put64(&bytes[20], seed);
+    put32(&bytes[28], (uint32_t)quirks);
+    put32(&bytes[32], instructionsPerSecond);
+    put64(&bytes[36], length);
+    put64(&bytes[44], finalHash);
+    put32(&bytes[52], (uint32_t)events.size());
+    uint64_t previous = 0;
+    for (size_t i = 0; i < events.size(); i++) {
+        uint64_t delta = events[i].cycle - previous;
+        previous = events[i].cycle;
+        do {
+            bytes.push_back((delta & 0x7F) | (delta > 0x7F ? 0x80 : 0));
+            delta >>= 7;
+        } while (delta != 0);
+        bytes.push_back(events[i].keypad & 0xFF);
+        bytes.push_back(events[i].keypad >> 8);
+    }
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        std::cerr << "Failed to open movie for writing: " << path << std::endl;
+        return false;
+    }
+    bool written = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    if (fclose(file) != 0 || !written) {
+        std::cerr << "Failed to write movie: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Movie::load(const char* path){
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        std::cerr << "Failed to open movie: " << path << std::endl;
+        return false;
+    }
+    std::vector<uint8_t> bytes;
+    uint8_t buffer [4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        bytes.insert(bytes.end(), buffer, buffer + n);
+    }
+    fclose(file);
+
+    if (bytes.size() < MOVIE_HEADER_SIZE || memcmp(&bytes[0], MOVIE_MAGIC, 8) != 0) {
+        std::cerr << "Not a movie: " << path << std::endl;
+        return false;
+    }
+    if (get32(&bytes[8]) != VERSION) {
+        std::cerr << "Movie was written by an incompatible version: " << path << std::endl;
+        return false;
+    }
+    // no movie is recorded at 0 instructions per second, and frame numbers divide by it
+    if (get32(&bytes[28]) >= (uint32_t)QUIRKS_COUNT || get32(&bytes[32]) == 0) {
+        std::cerr << "Movie has invalid settings: " << path << std::endl;
+        return false;
+    }
+    romHash = get64(&bytes[12]);
+    seed = get64(&bytes[20]);
+    quirks = (QuirkProfile)get32(&bytes[28]);
+    instructionsPerSecond = get32(&bytes[32]);
+    length = get64(&bytes[36]);
+    finalHash = get64(&bytes[44]);
+    uint32_t count = get32(&bytes[52]);
+
+    events.clear();
+    size_t at = MOVIE_HEADER_SIZE;
+    uint64_t cycle = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t delta = 0;
+        int shift = 0;
+        while (at < bytes.size() && (bytes[at] & 0x80) && shift < 63) {
+            delta |= (uint64_t)(bytes[at++] & 0x7F) << shift;
+            shift += 7;
+        }
+        if (at + 3 > bytes.size()) {
+            std::cerr << "Movie is truncated: " << path << std::endl;
+            return false;
+        }
+        delta |= (uint64_t)bytes[at++] << shift;
+        cycle += delta;
+        MovieEvent event = { cycle, (uint16_t)(bytes[at] | bytes[at + 1] << 8) };
+        at += 2;
+        events.push_back(event);
+    }
+    return true;
+}
+
+MoviePlayer::MoviePlayer(CPU& c, const Movie& m, uint32_t keyframeInterval)
+    : cpu(c), movie(m), interval(keyframeInterval), next(0) {}
+
+bool MoviePlayer::start(){
+    if (cpu.getROMHash() != movie.romHash) {
+        std::cerr << "The movie was recorded with a different ROM" << std::endl;
+        return false;
+    }
+    cpu.setAudio(NULL);
+    cpu.setSeed(movie.seed);
+    cpu.setQuirks(movie.quirks);
+    cpu.setInstructionsPerSecond(movie.instructionsPerSecond);
+    next = 0;
+    applyEvents();
+    // the first keyframe is power-on, which is also where seeking back goes without an interval
+    keyframes.clear();
+    keyframes.reserve(interval > 0 ? frameCount() / interval + 1 : 1);
+    keyframes.push_back(cpu.snapshot());
+    return true;
+}
+
+void MoviePlayer::buildIndex(){
+    uint64_t frame = currentFrame();
+    runTo(movie.length);
+    seek(frame);
+}
+
+void MoviePlayer::applyEvents(){
+    while (next < movie.events.size() && movie.events[next].cycle <= cpu.getCycles()) {
+        cpu.setKeypad(movie.events[next++].keypad);
+    }
+}
+
+void MoviePlayer::runTo(uint64_t cycle){
+    if (cycle > movie.length) {
+        cycle = movie.length;
+    }
+    while (cpu.getCycles() < cycle) {
+        // stops at every keypad change, and at the next keyframe if it was not taken yet
+        uint64_t until = cycle;
+        if (next < movie.events.size() && movie.events[next].cycle < until) {
+            until = movie.events[next].cycle;
+        }
+        uint64_t keyframe = cycleOf(keyframes.size() * (uint64_t)interval);
+        if (interval > 0 && keyframe > cpu.getCycles() && keyframe < until) {
+            until = keyframe;
+        }
+        uint64_t remaining = until - cpu.getCycles();
+        // Run() takes an int, and a long stretch without input goes in pieces
+        cpu.Run(remaining > (1 << 24) ? (1 << 24) : (int)remaining);
+        applyEvents();
+        // below 60 instructions per second several frames can start at the same instruction
+        while (interval > 0 && cpu.getCycles() == cycleOf(keyframes.size() * (uint64_t)interval)) {
+            keyframes.push_back(cpu.snapshot());
+        }
+    }
+}
+
+void MoviePlayer::seek(uint64_t frame){
+    uint64_t target = cycleOf(frame);
+    if (target > movie.length) {
+        target = movie.length;
+    }
+    size_t k = (interval > 0) ? (size_t)(frameOf(target) / interval) : 0;
+    if (k >= keyframes.size()) {
+        k = keyframes.size() - 1;
+    }
+    // from before the target and no further back than its keyframe, running on is quicker
+    if (target < cpu.getCycles() || keyframes[k].cycles > cpu.getCycles()) {
+        cpu.restore(keyframes[k]);
+        // the keyframe was taken after the changes at its instruction were applied
+        next = 0;
+        while (next < movie.events.size() && movie.events[next].cycle <= cpu.getCycles()) {
+            next++;
+        }
+    }
+    runTo(target);
+}
+
+uint64_t MoviePlayer::currentFrame() const {
+    return frameOf(cpu.getCycles());
+}
+
+bool MoviePlayer::finished() const {
+    return cpu.getCycles() >= movie.length;
+}
+
+int runReplay(CPU& cpu, const Movie& movie, bool perf){
+    MoviePlayer player(cpu, movie, 0);
+    if (!player.start()) {
+        return 1;
+    }
+    PerfCounters counters;
+    if (perf && !counters.anyAvailable()) {
+        std::cerr << "No hardware performance counters are available" << std::endl;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (perf) { counters.start(); }
+    player.runTo(movie.length);
+    if (perf) { counters.stop(); }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    long long instructions = (long long)movie.length;
+    long long frames = instructions * 60 / movie.instructionsPerSecond;
+    printf("Replayed %zu keypad changes over %lld instructions (%.2f s of emulated time) in %.6f s\n",
+           movie.events.size(), instructions, (double)instructions / movie.instructionsPerSecond, seconds);
+    if (seconds > 0) {
+        printf("Instructions/s: %.0f\n", instructions / seconds);
+    }
+    uint64_t hash = hashState(cpu.snapshot());
+    printf("State hash: %016llx, recorded %016llx\n", (unsigned long long)hash, (unsigned long long)movie.finalHash);
+    if (perf) {
+        counters.report(instructions, frames);
+    }
+    if (hash != movie.finalHash) {
+        std::cerr << "Replay did not end in the recorded state" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int runSeek(CPU& cpu, const Movie& movie, uint64_t frame, uint32_t keyframeInterval){
+    MoviePlayer player(cpu, movie, keyframeInterval);
+    if (!player.start()) {
+        return 1;
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    player.buildIndex();
+    std::chrono::steady_clock::time_point indexed = std::chrono::steady_clock::now();
+    // from the end, the farthest a seek can go back
+    player.seek(player.frameCount());
+    std::chrono::steady_clock::time_point seekStart = std::chrono::steady_clock::now();
+    player.seek(frame);
+    double seekSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - seekStart).count();
+
+    printf("Indexed %llu frames into %zu keyframes in %.3f ms\n", (unsigned long long)player.frameCount(),
+           player.keyframeCount(), std::chrono::duration<double>(indexed - start).count() * 1e3);
+    printf("Seeked from the end to frame %llu in %.3f ms\n", (unsigned long long)player.currentFrame(), seekSeconds * 1e3);
+    printf("State hash: %016llx\n", (unsigned long long)hashState(cpu.snapshot()));
+    return 0;
+}
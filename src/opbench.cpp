@@ -0,0 +1,191 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <random>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include "cpu.h"
+
+// ch8opbench, times each opcode family on its own through CPU::executeOpcode(). Every family gets
+// a batch of opcodes with random operands, run once to warm the caches and then timed over many
+// samples, each starting from freshly randomized registers. Only the public CPU interface is used:
+// registers are set with 6XNN and I with ANNN, like a program would.
+
+#define OPBENCH_BATCH 1024   // opcodes in one batch
+#define OPBENCH_PASSES 64    // batches per sample
+#define OPBENCH_SAMPLES 31   // samples per family, the table shows their median and range
+
+// sprite data and FX33/FX55 stores go here, clear of the font and of any code
+#define OPBENCH_DATA 0x800
+
+struct Family {
+    std::string name;
+    std::vector<uint16_t> opcodes;
+    // registers set before every sample, on top of the random ones, e.g. coordinates for DXYN
+    std::vector<uint16_t> setup;
+    // opcode run before every one of the batch and left out of its time, for FX55/FX65, which move I
+    // along under the vip and xochip quirks and would otherwise walk it through all of memory
+    uint16_t reset;
+};
+
+static std::mt19937 rng(2024); // fixed, so every run times the same operands
+
+static int randomBelow(int below) { return rng() % below; }
+
+// a batch of opcodes built from a pattern where every X and Y nibble is random
+static Family family(const std::string& name, uint16_t pattern, bool randomX, bool randomY, bool randomNN) {
+    Family f;
+    f.name = name;
+    f.reset = 0;
+    for (int i = 0; i < OPBENCH_BATCH; i++) {
+        uint16_t opcode = pattern;
+        if (randomX) { opcode |= randomBelow(15) << 8; } // VF is left out, it is the flag register
+        if (randomY) { opcode |= randomBelow(15) << 4; }
+        if (randomNN) { opcode |= randomBelow(256); }
+        f.opcodes.push_back(opcode);
+    }
+    return f;
+}
+
+static void randomizeRegisters(CPU& cpu, const Family& f) {
+    for (int x = 0; x < 16; x++) {
+        cpu.executeOpcode(0x6000 | x << 8 | randomBelow(256));
+    }
+    cpu.executeOpcode(0xA000 | OPBENCH_DATA);
+    for (size_t i = 0; i < f.setup.size(); i++) {
+        cpu.executeOpcode(f.setup[i]);
+    }
+}
+
+// returns the nanoseconds per opcode of every sample, sorted
+static std::vector<double> timeFamily(CPU& cpu, const Family& f) {
+    std::vector<double> samples;
+    randomizeRegisters(cpu, f);
+    for (size_t i = 0; i < f.opcodes.size(); i++) { // warm up
+        if (f.reset != 0) { cpu.executeOpcode(f.reset); }
+        cpu.executeOpcode(f.opcodes[i]);
+    }
+    for (int s = 0; s < OPBENCH_SAMPLES; s++) {
+        randomizeRegisters(cpu, f);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int pass = 0; pass < OPBENCH_PASSES; pass++) {
+            for (size_t i = 0; i < f.opcodes.size(); i++) {
+                if (f.reset != 0) { cpu.executeOpcode(f.reset); }
+                cpu.executeOpcode(f.opcodes[i]);
+            }
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (f.reset != 0) {
+            // the same number of resets on their own, taken back out of the time
+            start = std::chrono::steady_clock::now();
+            for (int pass = 0; pass < OPBENCH_PASSES; pass++) {
+                for (size_t i = 0; i < f.opcodes.size(); i++) {
+                    cpu.executeOpcode(f.reset);
+                }
+            }
+            seconds -= std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        samples.push_back(seconds * 1e9 / (OPBENCH_PASSES * f.opcodes.size()));
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples;
+}
+
+static std::vector<Family> families() {
+    std::vector<Family> all;
+    all.push_back(family("6XNN ld", 0x6000, true, false, true));
+    all.push_back(family("7XNN add", 0x7000, true, false, true));
+    all.push_back(family("8XY0 ld", 0x8000, true, true, false));
+    all.push_back(family("8XY1 or", 0x8001, true, true, false));
+    all.push_back(family("8XY2 and", 0x8002, true, true, false));
+    all.push_back(family("8XY3 xor", 0x8003, true, true, false));
+    all.push_back(family("8XY4 add", 0x8004, true, true, false));
+    all.push_back(family("8XY5 sub", 0x8005, true, true, false));
+    all.push_back(family("8XY6 shr", 0x8006, true, true, false));
+    all.push_back(family("8XY7 subn", 0x8007, true, true, false));
+    all.push_back(family("8XYE shl", 0x800E, true, true, false));
+    all.push_back(family("3XNN se", 0x3000, true, false, true));
+    all.push_back(family("4XNN sne", 0x4000, true, false, true));
+    all.push_back(family("5XY0 se", 0x5000, true, true, false));
+    all.push_back(family("9XY0 sne", 0x9000, true, true, false));
+    all.push_back(family("EX9E skp", 0xE09E, true, false, false));
+    all.push_back(family("EXA1 sknp", 0xE0A1, true, false, false));
+    Family loadI = family("ANNN ld i", 0xA000, false, false, false);
+    for (size_t i = 0; i < loadI.opcodes.size(); i++) {
+        loadI.opcodes[i] |= OPBENCH_DATA + randomBelow(0x100);
+    }
+    all.push_back(loadI);
+    all.push_back(family("FX1E add i", 0xF01E, true, false, false));
+    all.push_back(family("FX29 ld f", 0xF029, true, false, false));
+    all.push_back(family("CXNN rnd", 0xC000, true, false, true));
+    all.push_back(family("00E0 cls", 0x00E0, false, false, false));
+
+    // DXYN draws with V0/V1 inside the screen and with V2/V3 at the bottom right corner, where
+    // most of the sprite is clipped
+    for (int n = 1; n <= 15; n++) {
+        char name [32];
+        snprintf(name, sizeof(name), "D01%X drw", n);
+        Family inside = family(name, 0xD010 | n, false, false, false);
+        inside.setup.push_back(0x6000 | randomBelow(56));
+        inside.setup.push_back(0x6100 | randomBelow(32 - n));
+        all.push_back(inside);
+    }
+    for (int n = 1; n <= 15; n++) {
+        char name [32];
+        snprintf(name, sizeof(name), "D23%X drw clip", n);
+        Family clipped = family(name, 0xD230 | n, false, false, false);
+        clipped.setup.push_back(0x6200 | 60);
+        clipped.setup.push_back(0x6300 | 28);
+        all.push_back(clipped);
+    }
+
+    all.push_back(family("FX33 bcd", 0xF033, true, false, false));
+    for (int x = 0; x < 16; x += 5) {
+        char name [32];
+        snprintf(name, sizeof(name), "F%X55 ld [i]", x);
+        Family store = family(name, 0xF055 | x << 8, false, false, false);
+        store.reset = 0xA000 | OPBENCH_DATA;
+        all.push_back(store);
+    }
+    for (int x = 0; x < 16; x += 5) {
+        char name [32];
+        snprintf(name, sizeof(name), "F%X65 ld v", x);
+        Family load = family(name, 0xF065 | x << 8, false, false, false);
+        load.reset = 0xA000 | OPBENCH_DATA;
+        all.push_back(load);
+    }
+
+    return all;
+}
+
+int main(int argc, char** argv) {
+    QuirkProfile quirks = QUIRKS_DEFAULT;
+    bool usageError = false;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--quirks=", 9) == 0) {
+            usageError |= !parseQuirkProfile(argv[i] + 9, quirks);
+        } else {
+            usageError = true;
+        }
+    }
+    if (usageError) {
+        std::cout << "Usage: ./ch8opbench [--quirks=default|vip|schip|xochip]" << std::endl;
+        return 1;
+    }
+
+    CPU cpu;
+    cpu.setQuirks(quirks);
+
+    std::vector<Family> all = families();
+    printf("\n%d opcodes per sample, %d samples per family, %s quirks\n",
+           OPBENCH_BATCH * OPBENCH_PASSES, OPBENCH_SAMPLES, quirkProfileName(quirks));
+    printf("%-18s %10s %10s %10s\n", "opcode", "ns/op", "min", "max");
+    for (size_t i = 0; i < all.size(); i++) {
+        std::vector<double> samples = timeFamily(cpu, all[i]);
+        printf("%-18s %10.2f %10.2f %10.2f\n", all[i].name.c_str(),
+               samples[samples.size() / 2], samples.front(), samples.back());
+    }
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <cstring>
+#include "perfcounters.h"
+
+#if defined(__linux__)
+#define CHIP8_PERF_SUPPORTED 1
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static const char* const counterNames[PerfCounters::COUNTER_COUNT] = {
+    "cycles", "instructions", "branch-misses", "L1D-misses"
+};
+
+#ifdef CHIP8_PERF_SUPPORTED
+static int openCounter(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1; // only the emulator's own work, and allowed at perf_event_paranoid 2
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0); // this thread, any CPU, no group
+}
+#endif
+
+PerfCounters::PerfCounters(){
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        fds[i] = -1;
+        values[i] = 0;
+    }
+#ifdef CHIP8_PERF_SUPPORTED
+    fds[CYCLES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    fds[INSTRUCTIONS] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    fds[BRANCH_MISSES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    fds[L1D_MISSES] = openCounter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+                                  | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+#endif
+}
+
+PerfCounters::~PerfCounters(){
+#ifdef CHIP8_PERF_SUPPORTED
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (fds[i] >= 0) { close(fds[i]); }
+    }
+#endif
+}
+
+bool PerfCounters::anyAvailable() const {
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (fds[i] >= 0) { return true; }
+    }
+    return false;
+}
+
+void PerfCounters::start(){
+#ifdef CHIP8_PERF_SUPPORTED
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (fds[i] >= 0) {
+            ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+void PerfCounters::stop(){
+#ifdef CHIP8_PERF_SUPPORTED
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (fds[i] >= 0) { ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0); }
+    }
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        values[i] = 0;
+        uint64_t data [3]; // value, time enabled, time running
+        if (fds[i] < 0 || read(fds[i], data, sizeof(data)) != sizeof(data)) {
+            continue;
+        }
+        // a counter that only ran for part of the time is extrapolated to all of it
+        values[i] = (data[2] != 0 && data[2] < data[1]) ? (uint64_t)((double)data[0] * data[1] / data[2]) : data[0];
+    }
+#endif
+}
+
+const char* PerfCounters::name(Counter counter){
+    return counterNames[counter];
+}
+
+void PerfCounters::report(long long instructions, long long frames) const {
+    printf("%-14s %16s %14s %14s\n", "counter", "total", "per instr", "per frame");
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (fds[i] < 0) {
+            printf("%-14s %16s\n", counterNames[i], "not available");
+            continue;
+        }
+        printf("%-14s %16llu %14.3f %14.1f\n", counterNames[i], (unsigned long long)values[i],
+               instructions > 0 ? (double)values[i] / instructions : 0.0,
+               frames > 0 ? (double)values[i] / frames : 0.0);
+    }
+}
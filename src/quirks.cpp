@@ -0,0 +1,33 @@
+#include <cstring>
+#include "quirks.h"
+
+template <class Q>
+static QuirkFlags flagsOf() {
+    QuirkFlags flags = { Q::shiftUsesVY, Q::memoryIncrementsI, Q::jumpUsesVX, Q::clipSprites, Q::logicResetsVF };
+    return flags;
+}
+
+QuirkFlags quirkFlags(QuirkProfile profile) {
+    switch (profile) {
+    case QUIRKS_VIP: return flagsOf<QuirksVIP>();
+    case QUIRKS_SCHIP: return flagsOf<QuirksSCHIP>();
+    case QUIRKS_XOCHIP: return flagsOf<QuirksXOCHIP>();
+    default: return flagsOf<QuirksDefault>();
+    }
+}
+
+static const char* const profileNames[QUIRKS_COUNT] = { "default", "vip", "schip", "xochip" };
+
+const char* quirkProfileName(QuirkProfile profile) {
+    return (profile >= 0 && profile < QUIRKS_COUNT) ? profileNames[profile] : profileNames[QUIRKS_DEFAULT];
+}
+
+bool parseQuirkProfile(const char* name, QuirkProfile& profile) {
+    for (int i = 0; i < QUIRKS_COUNT; ++i) {
+        if (strcmp(name, profileNames[i]) == 0) {
+            profile = (QuirkProfile)i;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,224 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include "cpu.h"
+
+// ch8rec, the static recompiler. Follows the control flow of a ROM from 0x200 and writes a C++
+// translation unit with one function per block it finds. Each instruction becomes a call to
+// CPU::executeAt() with a constant DecodedOp, which the compiler reduces to that instruction's body
+// under the quirk profile picked with --quirks.
+// Anything the walk cannot see (BNNN targets, code written at runtime) is left to the interpreter.
+
+#define REC_MAX_BLOCK_INSTRUCTIONS 64
+
+// names to print for each OpHandler, in the same order
+static const char* const handlerNames[] = {
+    "OP_UNDECODED", "OP_NOP", "OP_CLS", "OP_RET", "OP_JP",
+    "OP_CALL", "OP_SE_NN", "OP_SNE_NN", "OP_SE_VY", "OP_LD_NN",
+    "OP_ADD_NN", "OP_LD_VY", "OP_OR", "OP_AND", "OP_XOR",
+    "OP_ADD_VY", "OP_SUB", "OP_SHR", "OP_SUBN", "OP_SHL",
+    "OP_SNE_VY", "OP_LD_I", "OP_JP_V0", "OP_RND", "OP_DRW",
+    "OP_SKP", "OP_SKNP", "OP_LD_VX_DT", "OP_LD_VX_K", "OP_LD_DT_VX",
+    "OP_LD_ST_VX", "OP_ADD_I", "OP_LD_F", "OP_LD_B", "OP_LD_MEM_VX",
+    "OP_LD_VX_MEM", "OP_JP_SELF", "OP_WAIT_DT"
+};
+static_assert(sizeof(handlerNames) / sizeof(handlerNames[0]) == OP_COUNT, "handler names do not match OpHandler");
+
+// quirk policy struct and enum value to print for each QuirkProfile, in the same order
+static const char* const quirkPolicies[] = { "QuirksDefault", "QuirksVIP", "QuirksSCHIP", "QuirksXOCHIP" };
+static const char* const quirkProfiles[] = { "QUIRKS_DEFAULT", "QUIRKS_VIP", "QUIRKS_SCHIP", "QUIRKS_XOCHIP" };
+static_assert(sizeof(quirkPolicies) / sizeof(quirkPolicies[0]) == QUIRKS_COUNT, "quirk policies do not match QuirkProfile");
+static_assert(sizeof(quirkProfiles) / sizeof(quirkProfiles[0]) == QUIRKS_COUNT, "quirk profiles do not match QuirkProfile");
+
+struct Block {
+    uint16_t start, end;
+    std::vector<uint16_t> opcodes;
+    std::vector<DecodedOp> ops;
+};
+
+static bool readROM(const char* path, std::vector<uint8_t>& rom) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        std::cerr << "Failed to Open ROM " << path << std::endl;
+        return false;
+    }
+    uint8_t buffer [0x1000 - 0x200 + 1];
+    size_t size = fread(buffer, 1, sizeof(buffer), file);
+    fclose(file);
+    if (size > 0x1000 - 0x200) {
+        std::cerr << "ROM too large for memory" << std::endl;
+        return false;
+    }
+    rom.assign(buffer, buffer + size);
+    return true;
+}
+
+// Walks the reachable code from 0x200. A block ends after any instruction that can leave the
+// straight line (jumps, calls, returns, skips, FX0A), after FX33/FX55, whose stores may change
+// the code that follows, and after the start of an idle loop, so the CPU can skip the rest of it.
+static std::vector<Block> findBlocks(const std::vector<uint8_t>& rom) {
+    const uint16_t romEnd = 0x200 + rom.size();
+    std::vector<uint8_t> memory(0x1000, 0); // idle loops are recognized the same way as in RAM
+    std::copy(rom.begin(), rom.end(), memory.begin() + 0x200);
+    std::vector<bool> visited(0x1000, false);
+    std::vector<uint16_t> work(1, 0x200);
+    std::vector<Block> blocks;
+
+    while (!work.empty()) {
+        uint16_t start = work.back();
+        work.pop_back();
+        if (start < 0x200 || start + 1 >= romEnd || visited[start]) {
+            continue;
+        }
+        visited[start] = true;
+
+        Block block;
+        block.start = start;
+        block.end = 0;
+        uint16_t address = start;
+        bool ended = false;
+        while (!ended && address + 1 < romEnd) {
+            uint16_t opcode = rom[address - 0x200] << 8 | rom[address - 0x200 + 1];
+            DecodedOp op = CPU::decodeAt(&memory[0], address);
+            block.opcodes.push_back(opcode);
+            block.ops.push_back(op);
+            ended = true;
+            switch (op.handler) {
+            case OP_JP:
+                work.push_back(op.NNN);
+                break;
+            case OP_JP_SELF:
+                break;
+            case OP_WAIT_DT:
+                // the block also depends on the 3X00 and 1NNN that make this a loop
+                work.push_back(address + 2);
+                block.end = address + 6;
+                break;
+            case OP_CALL:
+                work.push_back(address + 2); // where 00EE comes back to
+                work.push_back(op.NNN);
+                break;
+            case OP_RET:
+            case OP_JP_V0:
+                break;
+            case OP_SE_NN:
+            case OP_SNE_NN:
+            case OP_SE_VY:
+            case OP_SNE_VY:
+            case OP_SKP:
+            case OP_SKNP:
+                work.push_back(address + 4);
+                work.push_back(address + 2);
+                break;
+            case OP_LD_VX_K:
+            case OP_LD_B:
+            case OP_LD_MEM_VX:
+                work.push_back(address + 2);
+                break;
+            default:
+                ended = block.opcodes.size() == REC_MAX_BLOCK_INSTRUCTIONS;
+                if (ended) { work.push_back(address + 2); }
+                break;
+            }
+            address += 2;
+        }
+        if (block.end < address) { block.end = address; }
+        blocks.push_back(block);
+    }
+    return blocks;
+}
+
+static bool readsOrWritesTimers(uint8_t handler) {
+    return handler == OP_LD_VX_DT || handler == OP_WAIT_DT || handler == OP_LD_DT_VX || handler == OP_LD_ST_VX;
+}
+
+static void writeBlock(FILE* out, const Block& block, QuirkProfile quirks) {
+    fprintf(out, "// 0x%03X-0x%03X\n", block.start, block.end);
+    fprintf(out, "static void block_%03X(CPU& cpu) {\n", block.start);
+    // the instruction count is emulated time, so it is brought up to date before anything that uses the timers
+    int pendingTicks = 0;
+    uint16_t address = block.start;
+    for (size_t i = 0; i < block.opcodes.size(); ++i, address += 2) {
+        const DecodedOp& op = block.ops[i];
+        if (readsOrWritesTimers(op.handler) && pendingTicks > 0) {
+            fprintf(out, "    cpu.addCycles(%d);\n", pendingTicks);
+            pendingTicks = 0;
+        }
+        fprintf(out, "    cpu.executeAt<%s>(0x%03X, DecodedOp{%s, 0x%X, 0x%X, 0x%X, 0x%02X, 0x%03X}); // %04X\n",
+                quirkPolicies[quirks], address, handlerNames[op.handler], op.X, op.Y, op.N, op.NN, op.NNN, block.opcodes[i]);
+        ++pendingTicks;
+    }
+    fprintf(out, "    cpu.addCycles(%d);\n", pendingTicks);
+    fprintf(out, "}\n\n");
+}
+
+int main(int argc, char** argv) {
+    QuirkProfile quirks = QUIRKS_DEFAULT;
+    const char* paths [2] = { NULL, NULL };
+    int pathCount = 0;
+    bool usageError = false;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--quirks=", 9) == 0) {
+            usageError |= !parseQuirkProfile(argv[i] + 9, quirks);
+        } else if (argv[i][0] != '-' && pathCount < 2) {
+            paths[pathCount++] = argv[i];
+        } else {
+            usageError = true;
+        }
+    }
+    if (usageError || pathCount != 2) {
+        std::cout << "Usage: ./ch8rec [--quirks=default|vip|schip|xochip] ROMfile output.cpp" << std::endl;
+        return 1;
+    }
+
+    std::vector<uint8_t> rom;
+    if (!readROM(paths[0], rom)) {
+        return 1;
+    }
+    if (rom.size() < 2) {
+        std::cerr << "ROM holds no instructions" << std::endl;
+        return 1;
+    }
+    std::vector<Block> blocks = findBlocks(rom);
+
+    FILE* out = fopen(paths[1], "w");
+    if (out == NULL) {
+        std::cerr << "Failed to open " << paths[1] << " for writing" << std::endl;
+        return 1;
+    }
+
+    std::string name = paths[0];
+    size_t slash = name.find_last_of("/\\");
+    if (slash != std::string::npos) {
+        name = name.substr(slash + 1);
+    }
+
+    fprintf(out, "// Generated by ch8rec from %s, do not edit.\n", name.c_str());
+    fprintf(out, "#include \"cpu_exec.h\"\n#include \"aot.h\"\n\n");
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        writeBlock(out, blocks[i], quirks);
+    }
+
+    fprintf(out, "static const uint8_t rom[] = {");
+    for (size_t i = 0; i < rom.size(); ++i) {
+        fprintf(out, "%s0x%02X,", (i % 16 == 0) ? "\n    " : " ", rom[i]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "static const AotBlock blocks[] = {\n");
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        fprintf(out, "    { 0x%03X, 0x%03X, %u, block_%03X },\n",
+                blocks[i].start, blocks[i].end, (unsigned)blocks[i].opcodes.size(), blocks[i].start);
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static const AotProgram program = { \"%s\", %s, rom, sizeof(rom), blocks, sizeof(blocks) / sizeof(blocks[0]) };\n",
+            name.c_str(), quirkProfiles[quirks]);
+    fprintf(out, "const AotProgram* const chip8AotProgram = &program;\n");
+    fclose(out);
+
+    std::cout << "Recompiled " << name << " (" << quirkProfileName(quirks) << " quirks): " << blocks.size() << " blocks" << std::endl;
+    return 0;
+}
@@ -0,0 +1,132 @@
+#include <iostream>
+#include <cstring>
+#include "renderer.h"
+
+namespace {
+
+const char* const vertexSource =
+    "#version 120\n"
+    "attribute vec2 position;\n"
+    "varying vec2 uv;\n"
+    "void main() {\n"
+    "    uv = vec2(position.x * 0.5 + 0.5, 0.5 - position.y * 0.5); // row 0 is the top of the screen\n"
+    "    gl_Position = vec4(position, 0.0, 1.0);\n"
+    "}\n";
+
+const char* const fragmentSource =
+    "#version 120\n"
+    "uniform sampler2D frame;\n"
+    "uniform vec3 background;\n"
+    "uniform vec3 foreground;\n"
+    "varying vec2 uv;\n"
+    "void main() {\n"
+    "    gl_FragColor = vec4(mix(background, foreground, texture2D(frame, uv).r), 1.0);\n"
+    "}\n";
+
+// a triangle strip covering the viewport
+const GLfloat corners[] = { -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f };
+
+GLuint compileShader(GLenum type, const char* source) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    GLint compiled = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (compiled != GL_TRUE) {
+        char log [512];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        std::cerr << "Failed to compile shader: " << log << std::endl;
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+}
+
+Renderer::Renderer(){
+    texture = 0;
+    program = 0;
+    quad = 0;
+    memset(pixels, 0, sizeof(pixels));
+}
+
+Renderer::~Renderer(){
+    // deleting the name 0 is a no-op, so a renderer whose init() failed can go away as well
+    glDeleteTextures(1, &texture);
+    glDeleteBuffers(1, &quad);
+    glDeleteProgram(program);
+}
+
+bool Renderer::init(const float background[3], const float foreground[3]){
+    GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexSource);
+    GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
+    if (vertexShader == 0 || fragmentShader == 0) {
+        glDeleteShader(vertexShader);
+        glDeleteShader(fragmentShader);
+        return false;
+    }
+    program = glCreateProgram();
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+    glBindAttribLocation(program, 0, "position");
+    glLinkProgram(program);
+    // the program keeps the shaders alive for as long as it needs them
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (linked != GL_TRUE) {
+        char log [512];
+        glGetProgramInfoLog(program, sizeof(log), NULL, log);
+        std::cerr << "Failed to link shader program: " << log << std::endl;
+        return false;
+    }
+
+    // the palette and texture unit never change, so they are set once here
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "frame"), 0);
+    glUniform3fv(glGetUniformLocation(program, "background"), 1, background);
+    glUniform3fv(glGetUniformLocation(program, "foreground"), 1, foreground);
+
+    // nearest filtering keeps every CHIP-8 pixel a sharp rectangle at any window size
+    glGenTextures(1, &texture);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, 64, 32, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, pixels);
+
+    glGenBuffers(1, &quad);
+    glBindBuffer(GL_ARRAY_BUFFER, quad);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+    glEnableVertexAttribArray(0);
+    return true;
+}
+
+// init() left the program, texture and quad bound, and nothing else in the frontend binds any
+
+void Renderer::upload(const uint64_t* frame, uint32_t rows){
+    if (rows == 0) {
+        return;
+    }
+    int first = 0, last = 31;
+    while (!(rows & (1u << first))) { ++first; }
+    while (!(rows & (1u << last))) { --last; }
+    for (int y = first; y <= last; y++) {
+        uint64_t row = frame[y];
+        for (int x = 0; x < 64; x++) {
+            pixels[y][x] = ((row >> (63 - x)) & 1) ? 255 : 0;
+        }
+    }
+    // one upload covering every changed row, the clean ones in between are sent again unchanged
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first, 64, last - first + 1, GL_LUMINANCE, GL_UNSIGNED_BYTE, pixels[first]);
+}
+
+void Renderer::draw(){
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
@@ -0,0 +1,121 @@
+#include <cstring>
+#include "rewind.h"
+
+static_assert(sizeof(CPUState) % 8 == 0, "the deltas work on whole 64-bit words");
+
+// A delta is a series of runs, each a 32-bit header with the number of unchanged words in the high
+// half and the number of changed words following them in the low half, then the changed words
+// themselves. Words are copied with memcpy, which compiles to plain loads and stores.
+#define REWIND_MAX_DELTA_BYTES (sizeof(CPUState) / 8 * 12 + 4) // every other word changed
+
+RewindBuffer::RewindBuffer(size_t maxFrames, size_t maxBytes)
+    : data(maxBytes > REWIND_MAX_DELTA_BYTES ? maxBytes : REWIND_MAX_DELTA_BYTES),
+      entries(maxFrames > 0 ? maxFrames : 1), scratch(REWIND_MAX_DELTA_BYTES) {
+    clear();
+}
+
+void RewindBuffer::clear(){
+    captured = false;
+    first = 0;
+    count = 0;
+    used = 0;
+}
+
+size_t RewindBuffer::encodeDelta(const CPUState& state){
+    const uint8_t* a = (const uint8_t*)&last;
+    const uint8_t* b = (const uint8_t*)&state;
+    uint8_t* out = scratch.data();
+    size_t length = 0;
+    size_t w = 0;
+    while (w < WORDS) {
+        uint32_t same = 0;
+        uint64_t x = 0, y = 0;
+        for (; w < WORDS; w++, same++) {
+            memcpy(&x, a + w * 8, 8);
+            memcpy(&y, b + w * 8, 8);
+            if (x != y) { break; }
+        }
+        if (w == WORDS) {
+            break; // the delta ends with the last changed word
+        }
+        uint8_t* header = out + length;
+        length += 4;
+        uint32_t changed = 0;
+        for (; w < WORDS; w++, changed++) {
+            memcpy(&x, a + w * 8, 8);
+            memcpy(&y, b + w * 8, 8);
+            if (x == y) { break; }
+            uint64_t delta = x ^ y;
+            memcpy(out + length, &delta, 8);
+            length += 8;
+        }
+        uint32_t run = same << 16 | changed;
+        memcpy(header, &run, 4);
+    }
+    return length;
+}
+
+void RewindBuffer::dropOldest(){
+    used -= entries[first].size;
+    first = (first + 1) % entries.size();
+    count--;
+}
+
+void RewindBuffer::capture(const CPUState& state){
+    if (!captured) {
+        memcpy(&last, &state, sizeof(CPUState));
+        captured = true;
+        return;
+    }
+    size_t size = encodeDelta(state);
+
+    if (count == entries.size()) { dropOldest(); }
+    // the new delta goes right after the newest one, or back at the start of data if it does not
+    // fit before the end, and the oldest deltas in its way are dropped
+    size_t offset = 0;
+    if (count > 0) {
+        const Entry& newest = entries[(first + count - 1) % entries.size()];
+        offset = newest.offset + newest.size;
+    }
+    if (offset + size > data.size()) {
+        while (count > 0 && entries[first].offset >= offset) { dropOldest(); }
+        offset = 0;
+    }
+    while (count > 0 && entries[first].offset >= offset && entries[first].offset < offset + size) { dropOldest(); }
+
+    memcpy(data.data() + offset, scratch.data(), size);
+    Entry& entry = entries[(first + count) % entries.size()];
+    entry.offset = (uint32_t)offset;
+    entry.size = (uint32_t)size;
+    count++;
+    used += size;
+    memcpy(&last, &state, sizeof(CPUState));
+}
+
+bool RewindBuffer::stepBack(){
+    if (count == 0) {
+        return false;
+    }
+    const Entry& newest = entries[(first + count - 1) % entries.size()];
+    const uint8_t* in = data.data() + newest.offset;
+    const uint8_t* end = in + newest.size;
+    uint8_t* state = (uint8_t*)&last;
+    size_t w = 0;
+    while (in < end) {
+        uint32_t run;
+        memcpy(&run, in, 4);
+        in += 4;
+        w += run >> 16;
+        for (uint32_t i = 0; i < (run & 0xFFFF); i++, w++) {
+            uint64_t word, delta;
+            memcpy(&word, state + w * 8, 8);
+            memcpy(&delta, in, 8);
+            word ^= delta;
+            memcpy(state + w * 8, &word, 8);
+            in += 8;
+        }
+    }
+    used -= newest.size;
+    count--;
+    return true;
+}
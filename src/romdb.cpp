@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <iostream>
+#include <cstring>
+#include "romdb.h"
+
+// reads "RRGGBB" into three 0-1 floats
+static bool parseColor(const char* text, size_t length, float color[3]){
+    if (length != 6) {
+        return false;
+    }
+    char digits [7];
+    memcpy(digits, text, 6);
+    digits[6] = '\0';
+    char* end;
+    unsigned long rgb = strtoul(digits, &end, 16);
+    if (*end != '\0') {
+        return false;
+    }
+    for (int i = 0; i < 3; i++) {
+        color[i] = ((rgb >> (16 - 8 * i)) & 0xFF) / 255.0f;
+    }
+    return true;
+}
+
+// fills in profile from the settings that follow the hash on a line
+static bool parseSettings(const std::string& line, size_t at, RomProfile& profile){
+    while (at < line.size()) {
+        while (at < line.size() && (line[at] == ' ' || line[at] == '\t')) { at++; }
+        if (at == line.size()) {
+            break;
+        }
+        size_t end = line.find_first_of(" \t", at);
+        if (end == std::string::npos) { end = line.size(); }
+        std::string setting = line.substr(at, end - at);
+        size_t equals = setting.find('=');
+        if (equals == std::string::npos) {
+            return false;
+        }
+        std::string key = setting.substr(0, equals);
+        std::string value = setting.substr(equals + 1);
+
+        if (key == "name") {
+            // the rest of the line, spaces and all
+            size_t last = line.find_last_not_of(" \t");
+            profile.name = line.substr(at + equals + 1, last + 1 - (at + equals + 1));
+            break;
+        } else if (key == "quirks") {
+            if (!parseQuirkProfile(value.c_str(), profile.quirks)) { return false; }
+            profile.hasQuirks = true;
+        } else if (key == "ips") {
+            char* stop;
+            long ips = strtol(value.c_str(), &stop, 10);
+            if (*stop != '\0' || ips <= 0) { return false; }
+            profile.instructionsPerSecond = (uint32_t)ips;
+        } else if (key == "keys") {
+            if (value.size() != 16) { return false; }
+            for (int k = 0; k < 16; k++) {
+                char c = value[k];
+                if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z'))) { return false; }
+                profile.keys[k] = c;
+            }
+            profile.hasKeys = true;
+        } else if (key == "palette") {
+            size_t comma = value.find(',');
+            if (comma == std::string::npos ||
+                !parseColor(value.c_str(), comma, profile.background) ||
+                !parseColor(value.c_str() + comma + 1, value.size() - comma - 1, profile.foreground)) {
+                return false;
+            }
+            profile.hasPalette = true;
+        } else {
+            return false;
+        }
+        at = end;
+    }
+    return true;
+}
+
+bool RomDatabase::load(const char* path){
+    profiles.clear();
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        if (errno != ENOENT) {
+            std::cerr << "Failed to open ROM database: " << path << std::endl;
+        }
+        return false;
+    }
+
+    char buffer [1024];
+    int lineNumber = 0;
+    while (fgets(buffer, sizeof(buffer), file) != NULL) {
+        lineNumber++;
+        std::string line(buffer);
+        line = line.substr(0, line.find_first_of("#\r\n"));
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos) {
+            continue; // blank or only a comment
+        }
+
+        RomProfile profile;
+        profile.hasQuirks = false;
+        profile.quirks = QUIRKS_DEFAULT;
+        profile.instructionsPerSecond = 0;
+        profile.hasKeys = false;
+        profile.hasPalette = false;
+        size_t end = line.find_first_of(" \t", start);
+        if (end == std::string::npos) { end = line.size(); }
+        std::string hex = line.substr(start, end - start);
+        char* stop;
+        uint64_t hash = strtoull(hex.c_str(), &stop, 16);
+        if (hex.size() != 16 || *stop != '\0' || !parseSettings(line, end, profile)) {
+            std::cerr << path << ":" << lineNumber << ": not a valid ROM entry, skipped" << std::endl;
+            continue;
+        }
+        profiles[hash] = profile;
+    }
+    fclose(file);
+    return true;
+}
+
+const RomProfile* RomDatabase::find(uint64_t romHash) const {
+    std::unordered_map<uint64_t, RomProfile>::const_iterator it = profiles.find(romHash);
+    return (it != profiles.end()) ? &it->second : NULL;
+}
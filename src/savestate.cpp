@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <iostream>
+#include <cstring>
+#include "savestate.h"
+#include "cpu.h"
+
+#define SAVESTATE_MAGIC "CH8STATE"
+#define SAVESTATE_BYTE_ORDER 0x01020304
+
+struct SaveStateHeader {
+    char magic [8];
+    uint32_t version;
+    uint32_t size;
+    uint32_t byteOrder;
+};
+
+bool saveStateFile(const char* path, const CPUState& state){
+    SaveStateHeader header;
+    memcpy(header.magic, SAVESTATE_MAGIC, sizeof(header.magic));
+    header.version = SAVESTATE_VERSION;
+    header.size = sizeof(CPUState);
+    header.byteOrder = SAVESTATE_BYTE_ORDER;
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        std::cerr << "Failed to open save state for writing: " << path << std::endl;
+        return false;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(&state, sizeof(state), 1, file) == 1;
+    if (fclose(file) != 0 || !written) {
+        std::cerr << "Failed to write save state: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool loadStateFile(const char* path, CPUState& state){
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        std::cerr << "Failed to open save state: " << path << std::endl;
+        return false;
+    }
+    SaveStateHeader header;
+    CPUState loaded;
+    bool ok = false;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, SAVESTATE_MAGIC, sizeof(header.magic)) != 0) {
+        std::cerr << "Not a save state: " << path << std::endl;
+    } else if (header.version != SAVESTATE_VERSION || header.size != sizeof(CPUState) ||
+               header.byteOrder != SAVESTATE_BYTE_ORDER) {
+        std::cerr << "Save state was written by an incompatible build: " << path << std::endl;
+    } else if (fread(&loaded, sizeof(loaded), 1, file) != 1) {
+        std::cerr << "Save state is truncated: " << path << std::endl;
+    } else if (loaded.SP > 16 || loaded.PC > 0xFFE || loaded.instructionsPerSecond == 0) {
+        // restored as it is, so anything the CPU would index memory or the stack with, or divide by, is checked
+        std::cerr << "Save state is invalid: " << path << std::endl;
+    } else {
+        ok = true;
+    }
+    fclose(file);
+    if (ok) { state = loaded; }
+    return ok;
+}
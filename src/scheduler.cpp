@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <math.h>
+#include <chrono>
+#include <thread>
+#include "scheduler.h"
+
+#if defined(__linux__)
+#define CHIP8_CLOCK_NANOSLEEP 1
+#include <time.h>
+#endif
+
+// how long before a deadline the sleep ends and the spin takes over, enough to cover the usual
+// wake-up latency of a desktop kernel
+#define SCHEDULER_SPIN_NS 200000
+// a thread this many frames behind, e.g. after being suspended, starts counting from now instead
+// of running every missed frame back to back
+#define SCHEDULER_MAX_LAG_FRAMES 15
+
+uint64_t monotonicNanoseconds(){
+#ifdef CHIP8_CLOCK_NANOSLEEP
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// sleeps until the monotonic clock reads at least until
+static void sleepUntil(uint64_t until){
+#ifdef CHIP8_CLOCK_NANOSLEEP
+    struct timespec wake;
+    wake.tv_sec = until / 1000000000ULL;
+    wake.tv_nsec = until % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) != 0) {} // again if a signal cut it short
+#else
+    uint64_t now = monotonicNanoseconds();
+    if (until > now) { std::this_thread::sleep_for(std::chrono::nanoseconds(until - now)); }
+#endif
+}
+
+FrameScheduler::FrameScheduler(uint32_t framesPerSecond){
+    period = 1000000000ULL / framesPerSecond;
+    start();
+}
+
+void FrameScheduler::start(){
+    startTime = monotonicNanoseconds();
+    deadline = startTime;
+    lastWake = 0;
+    frames = 0;
+    lateMax = 0;
+    lateOverMillisecond = 0;
+    lateSum = 0;
+    lateSquares = 0;
+    intervalMin = UINT64_MAX;
+    intervalMax = 0;
+}
+
+uint64_t FrameScheduler::waitForNextFrame(){
+    uint64_t now = monotonicNanoseconds();
+    if (now > deadline + period * SCHEDULER_MAX_LAG_FRAMES) {
+        deadline = now;
+    }
+    if (deadline > now + SCHEDULER_SPIN_NS) {
+        sleepUntil(deadline - SCHEDULER_SPIN_NS);
+    }
+    do {
+        now = monotonicNanoseconds();
+    } while (now < deadline);
+
+    uint64_t late = now - deadline;
+    frames++;
+    lateSum += late;
+    lateSquares += (double)late * late;
+    if (late > lateMax) { lateMax = late; }
+    if (late > 1000000) { lateOverMillisecond++; }
+    if (lastWake != 0) {
+        uint64_t interval = now - lastWake;
+        if (interval < intervalMin) { intervalMin = interval; }
+        if (interval > intervalMax) { intervalMax = interval; }
+    }
+    lastWake = now;
+
+    deadline += period;
+    return now - startTime;
+}
+
+uint64_t FrameScheduler::resume(){
+    uint64_t now = monotonicNanoseconds();
+    deadline = now;
+    lastWake = 0;
+    return now - startTime;
+}
+
+void FrameScheduler::report() const {
+    if (frames == 0) {
+        return;
+    }
+    double mean = lateSum / frames;
+    double deviation = sqrt(fmax(0.0, lateSquares / frames - mean * mean));
+    printf("Frame pacing over %llu frames of %.3f ms:\n", (unsigned long long)frames, period / 1e6);
+    printf("  wake-up late by mean %.1f us, stddev %.1f us, max %.1f us, %llu frames over 1 ms\n",
+           mean / 1e3, deviation / 1e3, lateMax / 1e3, (unsigned long long)lateOverMillisecond);
+    if (frames > 1) {
+        printf("  frame interval min %.3f ms, max %.3f ms\n", intervalMin / 1e6, intervalMax / 1e6);
+    }
+}
@@ -0,0 +1,79 @@
+#include <iostream>
+#include "cpu.h"
+
+// Direct-threaded interpreter. Every handler ends by fetching the next predecoded instruction and
+// jumping straight to its handler through a label table, so there is no central switch that all
+// instructions share a single indirect branch through. Needs the labels-as-values extension of
+// GCC and Clang, other compilers fall back to Cycle().
+
+template <class Q>
+void CPU::runThreaded(int instructions){
+#if defined(__GNUC__)
+    // must list a label for every OpHandler, in the same order
+    static void* const handlers[] = {
+        &&L_OP_UNDECODED, &&L_OP_NOP, &&L_OP_CLS, &&L_OP_RET,
+        &&L_OP_JP, &&L_OP_CALL, &&L_OP_SE_NN, &&L_OP_SNE_NN,
+        &&L_OP_SE_VY, &&L_OP_LD_NN, &&L_OP_ADD_NN, &&L_OP_LD_VY,
+        &&L_OP_OR, &&L_OP_AND, &&L_OP_XOR, &&L_OP_ADD_VY,
+        &&L_OP_SUB, &&L_OP_SHR, &&L_OP_SUBN, &&L_OP_SHL,
+        &&L_OP_SNE_VY, &&L_OP_LD_I, &&L_OP_JP_V0, &&L_OP_RND,
+        &&L_OP_DRW, &&L_OP_SKP, &&L_OP_SKNP, &&L_OP_LD_VX_DT,
+        &&L_OP_LD_VX_K, &&L_OP_LD_DT_VX, &&L_OP_LD_ST_VX, &&L_OP_ADD_I,
+        &&L_OP_LD_F, &&L_OP_LD_B, &&L_OP_LD_MEM_VX, &&L_OP_LD_VX_MEM,
+        &&L_OP_JP_SELF, &&L_OP_WAIT_DT
+    };
+    static_assert(sizeof(handlers) / sizeof(handlers[0]) == OP_COUNT, "handler table does not match OpHandler");
+
+    if (instructions <= 0) {
+        return;
+    }
+
+    DecodedOp outside; // instructions outside 0x200-0xFFE are decoded again on every visit
+    const DecodedOp* current;
+
+// looks up the instruction at PC and jumps to its handler
+#define DISPATCH() \
+    if (PC >= DECODE_START && PC < DECODE_END) { current = &decodeCache[PC - DECODE_START]; } \
+    else { outside = decode(RAM[PC & 0xFFF] << 8 | RAM[(PC + 1) & 0xFFF]); current = &outside; } \
+    goto *handlers[current->handler]
+
+// the same bookkeeping as Cycle() after every instruction, then straight on to the next one
+#define OP(handler) L_##handler: { const DecodedOp& op = *current; (void)op;
+#define END_OP } \
+    PC += 2; \
+    cycles++; \
+    if (--instructions == 0) { return; } \
+    DISPATCH();
+// the same, except that an idle loop entered here spends what it can of the budget at once
+#define END_IDLE_OP } \
+    PC += 2; \
+    cycles++; \
+    if (--instructions == 0) { return; } \
+    if (idleOp != OP_UNDECODED) { instructions -= skipIdle(instructions); } \
+    if (instructions == 0) { return; } \
+    DISPATCH();
+
+    DISPATCH();
+
+L_OP_UNDECODED:
+    // first visit to this address, fill in the cache entry and dispatch again
+    decodeCache[PC - DECODE_START] = decodeAt(RAM, PC);
+    goto *handlers[current->handler];
+
+#include "cpu_ops.inc"
+
+#undef OP
+#undef END_OP
+#undef END_IDLE_OP
+#undef DISPATCH
+#else
+    for (int i = 0; i < instructions; i++) {
+        Cycle();
+    }
+#endif
+}
+
+template void CPU::runThreaded<QuirksDefault>(int instructions);
+template void CPU::runThreaded<QuirksVIP>(int instructions);
+template void CPU::runThreaded<QuirksSCHIP>(int instructions);
+template void CPU::runThreaded<QuirksXOCHIP>(int instructions);
@@ -0,0 +1,346 @@
+#include <iostream>
+#include <vector>
+#include <random>
+#include <cstdio>
+#include <cstring>
+#include "cpu.h"
+#include "rewind.h"
+#include "movie.h"
+#include "headless.h"
+
+// ch8test, runs small programs on every backend and quirk profile and checks the machine state
+// they leave behind, also after going back through the rewind buffer and when a recorded movie is
+// played again. "make test" builds and runs it, the exit code is the number of failed checks.
+
+static int failures = 0;
+
+static void check(bool ok, const char* backend, QuirkProfile quirks, const char* what) {
+    if (!ok) {
+        std::cout << "FAIL " << backend << " " << quirkProfileName(quirks) << ": " << what << std::endl;
+        failures++;
+    }
+}
+
+// V0..VF are stored with I = 0xFFE by FX55 with X = F, so the store runs 14 bytes past the end
+// of memory, then read back by FX65 from the same place. Both have to wrap around to address 0.
+static void memoryWrapsAround(CPU::ExecMode mode, const char* backend, QuirkProfile quirks) {
+    uint8_t program [64];
+    int size = 0;
+    for (int x = 0; x < 16; x++) { // 6XNN, VX = 0x10 + X
+        program[size++] = 0x60 | x;
+        program[size++] = 0x10 + x;
+    }
+    const uint16_t tail [] = { 0xAFFE, 0xFF55, 0x6000, 0x6F00, 0xAFFE, 0xFF65 };
+    for (size_t i = 0; i < sizeof(tail) / sizeof(tail[0]); i++) {
+        program[size++] = tail[i] >> 8;
+        program[size++] = tail[i] & 0xFF;
+    }
+    uint16_t self = 0x200 + size; // 1NNN jumping to itself, where the program stops
+    program[size++] = 0x10 | self >> 8;
+    program[size++] = self & 0xFF;
+
+    CPU cpu;
+    cpu.setQuirks(quirks);
+    if (!cpu.setExecMode(mode)) {
+        std::cout << "skip " << backend << ": not available in this build" << std::endl;
+        return;
+    }
+    cpu.loadROM(program, size);
+    cpu.Run(size / 2);
+
+    const CPUState& state = cpu.snapshot();
+    bool stored = state.RAM[0xFFE] == 0x10 && state.RAM[0xFFF] == 0x11;
+    for (int i = 0; i < 14; i++) { stored &= state.RAM[i] == 0x12 + i; }
+    check(stored, backend, quirks, "FX55 at I = 0xFFE did not wrap around to address 0");
+    bool loaded = true;
+    for (int i = 0; i < 16; i++) { loaded &= state.V[i] == 0x10 + i; }
+    check(loaded, backend, quirks, "FX65 at I = 0xFFE did not read back what FX55 stored");
+    check(state.PC == self, backend, quirks, "program did not reach its end");
+}
+
+// 1FFF jumps to the last byte of memory, so the instruction there takes its second byte from
+// address 0, where FX55 left 0x42: 6A at 0xFFF and 42 at 0x000 make 6A42.
+static void fetchWrapsAround(CPU::ExecMode mode, const char* backend, QuirkProfile quirks) {
+    uint8_t program [0x1000 - 0x200];
+    memset(program, 0, sizeof(program));
+    const uint16_t code [] = { 0x6042, 0xA000, 0xF055, 0x1FFF };
+    for (size_t i = 0; i < sizeof(code) / sizeof(code[0]); i++) {
+        program[2 * i] = code[i] >> 8;
+        program[2 * i + 1] = code[i] & 0xFF;
+    }
+    program[0xFFF - 0x200] = 0x6A;
+
+    CPU cpu;
+    cpu.setQuirks(quirks);
+    if (!cpu.setExecMode(mode)) {
+        return;
+    }
+    cpu.loadROM(program, sizeof(program));
+    cpu.Run(5);
+    check(cpu.snapshot().V[0xA] == 0x42, backend, quirks, "instruction at 0xFFF was not fetched across the end of memory");
+}
+
+// A small game loop using everything a session depends on: random numbers, the delay timer and
+// its idle wait, keys 0 and 1, FX0A, BCD, memory and drawing.
+static const uint16_t SESSION [] = {
+    0xA300, // 200: I = 0x300
+    0xC0FF, // 202: V0 = random
+    0x6106, // 204: V1 = 6
+    0xF115, // 206: delay = V1
+    0xF107, // 208: V1 = delay, until it is 0
+    0x3100, // 20A
+    0x1208, // 20C
+    0x6200, // 20E: V0 += 0x11 while key 0 is held
+    0xE2A1, // 210
+    0x7011, // 212
+    0x6201, // 214: while key 1 is held, wait for a key to be pressed and released
+    0xE2A1, // 216
+    0xF20A, // 218
+    0xF033, // 21A: BCD of V0 at I, read back into V0..V2
+    0xF265, // 21C
+    0xF129, // 21E: draw the tens digit at (V0, V1)
+    0xD015, // 220
+    0x1200, // 222
+};
+
+static void loadSession(CPU& cpu) {
+    uint8_t program [sizeof(SESSION)];
+    for (size_t i = 0; i < sizeof(SESSION) / sizeof(SESSION[0]); i++) {
+        program[2 * i] = SESSION[i] >> 8;
+        program[2 * i + 1] = SESSION[i] & 0xFF;
+    }
+    cpu.setSeed(7);
+    cpu.loadROM(program, sizeof(program));
+}
+
+// keys 0 and 1, held for a few frames at a time
+static uint16_t sessionKeys(std::mt19937& keys) {
+    return (keys() % 4 == 0) ? (uint16_t)(keys() % 4) : 0;
+}
+
+// Every frame of a session is kept both by the rewind buffer and in full. Stepping back has to give
+// each of the last frames bit for bit, and running on from one of them the same frames as before.
+// Both buffers have room for fewer frames than the session has: one is limited by frames, the other
+// by bytes, so its ring wraps around several times.
+static void rewindIsExact(CPU::ExecMode mode, const char* backend, size_t kept, size_t bytes) {
+    const int frames = 300;
+    CPU cpu;
+    if (!cpu.setExecMode(mode)) {
+        return;
+    }
+    loadSession(cpu);
+    RewindBuffer history(kept, bytes);
+    std::vector<CPUState> all(1, cpu.snapshot());
+    std::vector<uint16_t> keys;
+    std::mt19937 input(1);
+    history.capture(cpu.snapshot());
+    for (int f = 0; f < frames; f++) {
+        keys.push_back(sessionKeys(input));
+        cpu.setKeypad(keys.back());
+        cpu.Run(cpu.instructionsInFrame(f));
+        history.capture(cpu.snapshot());
+        all.push_back(cpu.snapshot());
+    }
+
+    size_t held = history.frames();
+    check(held > 0 && held <= kept && held < (size_t)frames, backend, QUIRKS_DEFAULT,
+          "rewind buffer did not drop its oldest frames");
+    bool exact = memcmp(&history.current(), &all[frames], sizeof(CPUState)) == 0;
+    int frame = frames;
+    while (history.stepBack()) {
+        frame--;
+        exact &= memcmp(&history.current(), &all[frame], sizeof(CPUState)) == 0;
+    }
+    check(exact, backend, QUIRKS_DEFAULT, "rewind did not give back the frames it captured");
+    check(frame == frames - (int)held, backend, QUIRKS_DEFAULT, "rewind did not go back as far as it kept");
+
+    cpu.restore(history.current());
+    bool same = true;
+    for (int f = frame; f < frames; f++) {
+        cpu.setKeypad(keys[f]);
+        cpu.Run(cpu.instructionsInFrame(f));
+        same &= memcmp(&cpu.snapshot(), &all[f + 1], sizeof(CPUState)) == 0;
+    }
+    check(same, backend, QUIRKS_DEFAULT, "running on after a rewind did not repeat the same frames");
+}
+
+// the instruction count after a frame of a recorded session and the frameHash() there
+struct SessionPoint {
+    uint64_t cycle;
+    uint64_t hash;
+};
+
+// hashState() without the keypad: a player stopped at the end of a frame has already set the keys
+// the next one starts with
+static uint64_t frameHash(const CPUState& state) {
+    CPUState copy = state;
+    copy.keypad = 0;
+    return hashState(copy);
+}
+
+// Records a session into movie the way the emulation thread does, keys at the start of every frame,
+// with now and then a rewind of a few frames that takes the changes after it out of the movie again.
+// points gets the state after every frame that is still part of the run at its end.
+static void recordSession(CPU::ExecMode mode, QuirkProfile quirks, Movie& movie, std::vector<SessionPoint>& points) {
+    CPU cpu;
+    cpu.setExecMode(mode);
+    cpu.setQuirks(quirks);
+    cpu.setInstructionsPerSecond(700);
+    loadSession(cpu);
+    movie.begin(cpu);
+    RewindBuffer history(600, 600 * 512);
+    history.capture(cpu.snapshot());
+    std::mt19937 input(2);
+    points.clear();
+    for (int f = 0; f < 600; f++) {
+        if (input() % 40 == 0) {
+            for (int back = input() % 20; back > 0 && history.stepBack(); back--) {
+                cpu.restore(history.current());
+                movie.truncate(cpu.getCycles());
+            }
+            while (!points.empty() && points.back().cycle > cpu.getCycles()) { points.pop_back(); }
+            continue;
+        }
+        uint16_t keys = sessionKeys(input);
+        movie.record(cpu.getCycles(), keys);
+        cpu.setKeypad(keys);
+        cpu.Run(1 + input() % 30);
+        history.capture(cpu.snapshot());
+        SessionPoint point = { cpu.getCycles(), frameHash(cpu.snapshot()) };
+        points.push_back(point);
+    }
+    movie.finish(cpu);
+}
+
+// A session recorded on one backend, saved and loaded again, has to go through the same states on
+// every backend when played.
+static void movieReplays(CPU::ExecMode mode, const char* backend, QuirkProfile quirks,
+                         const CPU::ExecMode* modes, const char* const* names, int modeCount) {
+    CPU probe;
+    if (!probe.setExecMode(mode)) {
+        return;
+    }
+    Movie recorded;
+    std::vector<SessionPoint> points;
+    recordSession(mode, quirks, recorded, points);
+    check(!points.empty() && points.back().cycle == recorded.length, backend, quirks, "movie does not end where the session did");
+
+    const char* path = "ch8test.movie";
+    Movie movie;
+    bool saved = recorded.save(path) && movie.load(path);
+    remove(path);
+    check(saved, backend, quirks, "movie could not be saved and loaded again");
+    if (!saved) {
+        return;
+    }
+    bool same = movie.romHash == recorded.romHash && movie.seed == recorded.seed && movie.quirks == recorded.quirks &&
+                movie.instructionsPerSecond == recorded.instructionsPerSecond && movie.length == recorded.length &&
+                movie.finalHash == recorded.finalHash && movie.events.size() == recorded.events.size();
+    for (size_t i = 0; same && i < movie.events.size(); i++) {
+        same = movie.events[i].cycle == recorded.events[i].cycle && movie.events[i].keypad == recorded.events[i].keypad;
+    }
+    check(same, backend, quirks, "movie read back differs from the one written");
+
+    for (int m = 0; m < modeCount; m++) {
+        CPU cpu;
+        if (!cpu.setExecMode(modes[m])) {
+            continue;
+        }
+        loadSession(cpu);
+        MoviePlayer player(cpu, movie, 0);
+        bool matched = player.start();
+        for (size_t i = 0; matched && i < points.size(); i++) {
+            player.runTo(points[i].cycle);
+            matched = frameHash(cpu.snapshot()) == points[i].hash;
+        }
+        player.runTo(movie.length);
+        matched &= player.finished() && hashState(cpu.snapshot()) == movie.finalHash;
+        if (!matched) {
+            std::cout << "FAIL " << backend << " " << quirkProfileName(quirks) << ": played on "
+                      << names[m] << ", the movie did not go through the recorded states" << std::endl;
+            failures++;
+        }
+    }
+}
+
+// Seeking through an indexed movie, forwards and backwards in any order, has to land on the same
+// state as playing it from the start up to that frame.
+static void seekMatchesPlayback(CPU::ExecMode mode, const char* backend) {
+    CPU linearCpu, seekCpu;
+    if (!linearCpu.setExecMode(mode) || !seekCpu.setExecMode(mode)) {
+        return;
+    }
+    Movie movie;
+    std::vector<SessionPoint> points;
+    recordSession(mode, QUIRKS_DEFAULT, movie, points);
+
+    loadSession(linearCpu);
+    MoviePlayer linear(linearCpu, movie, 0);
+    loadSession(seekCpu);
+    MoviePlayer seeking(seekCpu, movie, 7); // a short interval, so most seeks start from a keyframe
+    if (!linear.start() || !seeking.start()) {
+        check(false, backend, QUIRKS_DEFAULT, "movie player did not start");
+        return;
+    }
+    seeking.buildIndex();
+    std::vector<uint64_t> hashes;
+    for (uint64_t f = 0; f <= linear.frameCount(); f++) {
+        linear.seek(f); // never goes back, so this only plays on
+        hashes.push_back(frameHash(linearCpu.snapshot()));
+    }
+
+    std::mt19937 order(3);
+    bool same = true;
+    for (int i = 0; i < 200 && same; i++) {
+        uint64_t frame = order() % hashes.size();
+        seeking.seek(frame);
+        same = seeking.currentFrame() == frame && frameHash(seekCpu.snapshot()) == hashes[frame];
+    }
+    check(same, backend, QUIRKS_DEFAULT, "seeking did not land on the state playing up to the frame gives");
+}
+
+// With idle skipping off the idle loops of a session run instruction by instruction, which has to go
+// through the same states on every backend as on the switch interpreter.
+static void idleLoopsRunAlike(CPU::ExecMode mode, const char* backend, QuirkProfile quirks) {
+    CPU cpu, reference;
+    if (!cpu.setExecMode(mode)) {
+        return;
+    }
+    CPU* both [] = { &cpu, &reference };
+    for (int c = 0; c < 2; c++) {
+        both[c]->setIdleSkipping(false);
+        both[c]->setQuirks(quirks);
+        loadSession(*both[c]);
+    }
+    std::mt19937 input(4);
+    bool same = true;
+    for (int f = 0; f < 600 && same; f++) {
+        uint16_t keys = sessionKeys(input);
+        int instructions = 1 + input() % 30;
+        for (int c = 0; c < 2; c++) {
+            both[c]->setKeypad(keys);
+            both[c]->Run(instructions);
+        }
+        same = hashState(cpu.snapshot()) == hashState(reference.snapshot());
+    }
+    check(same, backend, quirks, "idle loops run one instruction at a time went differently than on the interpreter");
+}
+
+int main() {
+    const CPU::ExecMode modes [] = { CPU::EXEC_SWITCH, CPU::EXEC_THREADED, CPU::EXEC_JIT };
+    const char* names [] = { "switch", "threaded", "jit" };
+    for (int m = 0; m < 3; m++) {
+        for (int q = 0; q < QUIRKS_COUNT; q++) {
+            memoryWrapsAround(modes[m], names[m], (QuirkProfile)q);
+            fetchWrapsAround(modes[m], names[m], (QuirkProfile)q);
+            idleLoopsRunAlike(modes[m], names[m], (QuirkProfile)q);
+        }
+        rewindIsExact(modes[m], names[m], 100, 100 * 512);
+        rewindIsExact(modes[m], names[m], 1000, 4096); // raised to the largest possible delta, about 7 KB
+        movieReplays(modes[m], names[m], QUIRKS_DEFAULT, modes, names, 3);
+        movieReplays(modes[m], names[m], QUIRKS_VIP, modes, names, 3);
+        seekMatchesPlayback(modes[m], names[m]);
+    }
+    std::cout << (failures == 0 ? "All tests passed" : "Some tests failed") << std::endl;
+    return failures;
+}